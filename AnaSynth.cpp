@@ -19,7 +19,24 @@
 #include <map>
 #include <tuple>
 #include <unordered_map>
+#include <unordered_set>
 #include <algorithm>
+#include <span>
+#include <array>
+#include <complex>
+#include <sstream>
+#include <iomanip>
+#include <thread>
+#include <chrono>
+#include <cstdint>
+#include <bit>
+#include <atomic>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <cstdio>
+
+#include "AnaSynthEngine.h"
 
 emscripten::val window = emscripten::val::global("window");
 emscripten::val document = emscripten::val::global("document");
@@ -30,31 +47,531 @@ bool circuitCompleted = false;
 boost::uuids::random_generator uuidGenerator;
 std::vector<boost::uuids::uuid> uuids;
 static double resistance = 4, efficiency = 86.5, inductance = 0, capacitance = 0, frequency = 0, initialVolume = 0, timeConstant = 0, watts = 0, volts = 0, decibels = 0;
+static bool speakerModeled = false;
+static double coilInductance = 0.5, speakerResonance = 55, mechanicalQ = 3, electricalQ = 0.5; // mH, Hz, unitless, unitless
 static bool playButtonEnabled = false;
+static int scaleNote = 1; // the note page 8 asks for next, 1 to 13, and past 13 once the scale is done
 static bool nextButtonEnabled = false;
 
 static std::vector<bool> pianoKeys;
-static std::vector<bool> previousKeys;
 static std::vector<std::vector<boost::uuids::uuid>> pianouuids;
 
-static const std::map<std::string, double> frequencyMap = {
-  {"C4", 261.63},
-  {"C#", 277.18},
-  {"D", 293.66},
-  {"D#", 311.13},
-  {"E", 329.63},
-  {"F", 349.23},
-  {"F#", 369.99},
-  {"G", 392.00},
-  {"G#", 415.30},
-  {"A", 440.00},
-  {"A#", 466.16},
-  {"B", 493.88},
-  {"C5", 523.25}
+// keyCode of every piano key, in order from C4 to C5
+static constexpr std::array<int, 13> pianoKeyCodes = {90, 83, 88, 68, 67, 86, 71, 66, 72, 78, 74, 77, 188};
+
+constexpr std::array<int, 256> MakePianoKeyMap()
+{
+  std::array<int, 256> keyMap{};
+  keyMap.fill(-1);
+  for (int i = 0; i < int(pianoKeyCodes.size()); i++) {
+    keyMap[pianoKeyCodes[i]] = i;
+  }
+  return keyMap;
+}
+
+// keyCode -> piano key, -1 for keys that do not play anything
+static constexpr std::array<int, 256> pianoKeyMap = MakePianoKeyMap();
+
+namespace tuning
+{
+  // every table covers all 128 MIDI notes, which includes the 88 piano keys (A0 = 21 to C8 = 108)
+  constexpr int keyCount = 128;
+  constexpr int middleC = 60;
+  constexpr int concertA = 69;
+  using table = std::array<double, keyCount>;
+
+  constexpr double root(double x, int n)
+  {
+    // Newton's method, std::pow is not constexpr
+    double ans = 1 + (x - 1) / n;
+    for (int i = 0; i < 50; i++) {
+      double power = 1;
+      for (int j = 0; j < n - 1; j++) {
+        power *= ans;
+      }
+      ans -= (power * ans - x) / (n * power);
+    }
+    return ans;
+  }
+  constexpr table scale(const double* ratios, int notes, double period, double tonicFrequency, int tonicKey)
+  {
+    // repeats a scale given as ratios from its tonic, ratios[0] = 1, every period (usually an octave)
+    table ans{};
+    for (int key = 0; key < keyCount; key++) {
+      int degree = key - tonicKey;
+      int periods = degree >= 0 ? degree / notes : -((notes - 1 - degree) / notes);
+      double frequency = tonicFrequency * ratios[degree - periods * notes];
+      for (int i = 0; i < periods; i++) {
+        frequency *= period;
+      }
+      for (int i = 0; i > periods; i--) {
+        frequency /= period;
+      }
+      ans[key] = frequency;
+    }
+    return ans;
+  }
+  constexpr table equal_temperament(double reference = 440, int referenceKey = concertA)
+  {
+    // the semitone ratio is only ever raised to the 11th power and octaves are exact doublings,
+    // so the error does not build up across the keyboard, and the reference key comes out exact
+    double semitone = root(2, 12);
+    double ratios[12] = {1};
+    for (int i = 1; i < 12; i++) {
+      ratios[i] = ratios[i - 1] * semitone;
+    }
+    return scale(ratios, 12, 2, reference, referenceKey);
+  }
+  constexpr table just_intonation(double reference = 440, int referenceKey = concertA)
+  {
+    // 5-limit just intonation with C as the tonic, tuned so that referenceKey still sounds at reference
+    constexpr double ratios[12] = {1, 16.0/15, 9.0/8, 6.0/5, 5.0/4, 4.0/3, 45.0/32, 3.0/2, 8.0/5, 5.0/3, 9.0/5, 15.0/8};
+    table unscaled = scale(ratios, 12, 2, 1, middleC);
+    double tonic = reference / unscaled[referenceKey];
+    return scale(ratios, 12, 2, tonic, middleC);
+  }
+  constexpr table equalTemperament = equal_temperament();
+  constexpr table justIntonation = just_intonation();
+
+  std::optional<table> scala(const std::string& file, double tonicFrequency = equalTemperament[middleC], int tonicKey = middleC)
+  {
+    // Scala .scl files: lines starting with ! are comments, then a description, the number of notes, and one pitch
+    // per note, either in cents (has a '.') or as a ratio like 3/2 or 2. the last pitch is the period
+    std::vector<double> pitches;
+    int notes = -1;
+    bool described = false;
+    size_t position = 0;
+    while (position < file.size()) {
+      size_t end = file.find('\n', position);
+      if (end == std::string::npos) {
+        end = file.size();
+      }
+      std::string line = file.substr(position, end - position);
+      position = end + 1;
+      if (!line.empty() && line.back() == '\r') {
+        line.pop_back();
+      }
+      if (!line.empty() && line[0] == '!') {
+        continue;
+      }
+      if (!described) {
+        described = true;
+        continue;
+      }
+      size_t start = line.find_first_not_of(" \t");
+      if (start == std::string::npos) {
+        continue;
+      }
+      line = line.substr(start, line.find_first_of(" \t", start) - start);
+      try {
+        if (notes == -1) {
+          notes = std::stoi(line);
+        } else if (line.find('.') != std::string::npos) {
+          pitches.emplace_back(pow(2, std::stod(line) / 1200));
+        } else if (line.find('/') != std::string::npos) {
+          pitches.emplace_back(std::stod(line.substr(0, line.find('/'))) / std::stod(line.substr(line.find('/') + 1)));
+        } else {
+          pitches.emplace_back(std::stod(line));
+        }
+      } catch (...) {
+        return std::nullopt;
+      }
+    }
+    if (notes < 1 || pitches.size() < size_t(notes)) {
+      return std::nullopt;
+    }
+    std::vector<double> ratios = {1};
+    ratios.insert(ratios.end(), pitches.begin(), pitches.begin() + notes - 1);
+    return scale(ratios.data(), notes, pitches.at(notes - 1), tonicFrequency, tonicKey);
+  }
+  table capacitances(const table& frequencies, double inductance, double resistance)
+  {
+    // capacitance in nF that makes every key ring at its frequency for this inductance (in H) and resistance,
+    // the inverse of the damped frequency √(1/LC - (R/2L)²)/2π
+    table ans{};
+    double alpha = resistance / (2 * inductance);
+    for (int key = 0; key < keyCount; key++) {
+      double omega = 2*pi*frequencies[key];
+      ans[key] = 1000000000 / (inductance * (omega * omega + alpha * alpha));
+    }
+    return ans;
+  }
+  const table& capacitances_for(const table& frequencies, double inductance, double resistance)
+  {
+    // only recomputed when the circuit (or the tuning) changes, every other lookup is just an index
+    static const table* cachedFrequencies = nullptr;
+    static double cachedInductance = -1, cachedResistance = -1;
+    static table cached{};
+    if (cachedFrequencies != &frequencies || cachedInductance != inductance || cachedResistance != resistance) {
+      cached = capacitances(frequencies, inductance, resistance);
+      cachedFrequencies = &frequencies;
+      cachedInductance = inductance;
+      cachedResistance = resistance;
+    }
+    return cached;
+  }
+}
+
+namespace components
+{
+  // IEC 60063 preferred values, one decade each
+  enum class series { e12, e24, e96 };
+  constexpr std::array<double, 12> e12 = {1.0, 1.2, 1.5, 1.8, 2.2, 2.7, 3.3, 3.9, 4.7, 5.6, 6.8, 8.2};
+  constexpr std::array<double, 24> e24 = {1.0, 1.1, 1.2, 1.3, 1.5, 1.6, 1.8, 2.0, 2.2, 2.4, 2.7, 3.0,
+                                          3.3, 3.6, 3.9, 4.3, 4.7, 5.1, 5.6, 6.2, 6.8, 7.5, 8.2, 9.1};
+  constexpr std::array<double, 96> e96 = {1.00, 1.02, 1.05, 1.07, 1.10, 1.13, 1.15, 1.18, 1.21, 1.24, 1.27, 1.30,
+                                          1.33, 1.37, 1.40, 1.43, 1.47, 1.50, 1.54, 1.58, 1.62, 1.65, 1.69, 1.74,
+                                          1.78, 1.82, 1.87, 1.91, 1.96, 2.00, 2.05, 2.10, 2.15, 2.21, 2.26, 2.32,
+                                          2.37, 2.43, 2.49, 2.55, 2.61, 2.67, 2.74, 2.80, 2.87, 2.94, 3.01, 3.09,
+                                          3.16, 3.24, 3.32, 3.40, 3.48, 3.57, 3.65, 3.74, 3.83, 3.92, 4.02, 4.12,
+                                          4.22, 4.32, 4.42, 4.53, 4.64, 4.75, 4.87, 4.99, 5.11, 5.23, 5.36, 5.49,
+                                          5.62, 5.76, 5.90, 6.04, 6.19, 6.34, 6.49, 6.65, 6.81, 6.98, 7.15, 7.32,
+                                          7.50, 7.68, 7.87, 8.06, 8.25, 8.45, 8.66, 8.87, 9.09, 9.31, 9.53, 9.76};
+  std::span<const double> mantissas(series s)
+  {
+    switch (s) {
+      case series::e12:
+        return e12;
+      case series::e24:
+        return e24;
+      default:
+        return e96;
+    }
+  }
+  double nearest(double value, series s)
+  {
+    // closest preferred value on a log scale, which is how the series are spaced
+    std::span<const double> m = mantissas(s);
+    double decade = pow(10, floor(log10(value)));
+    double mantissa = value / decade;
+    auto above = std::lower_bound(m.begin(), m.end(), mantissa);
+    double high = above == m.end() ? 10 : *above;
+    double low = above == m.begin() ? m.back() / 10 : *(above - 1);
+    return decade * (mantissa / low < high / mantissa ? low : high);
+  }
+  enum class topology { single, parallel, series };
+  struct fit
+  {
+    topology wiring;
+    double first; // in nF
+    double second; // in nF, 0 for a single capacitor
+    double capacitance; // what the pair adds up to, in nF
+    double frequency; // in Hz
+    double cents; // off from the target
+  };
+  struct scale_fit
+  {
+    double inductance; // the preferred value actually used, in H
+    std::array<fit, tuning::keyCount> keys;
+  };
+  double cents(double frequency, double target)
+  {
+    return 1200 * log2(frequency / target);
+  }
+  const double nanofarads = 1e-9; // capacitances in here are in nF, circuit::damped_frequency takes F
+  fit fit_key(double target, double ideal, double inductance, double resistance, series s)
+  {
+    // candidates: the nearest single part, C1 ∥ C2 with C1 from [C/2, C], and C1 in series with C2 with C1 from [C, 2C],
+    // where C2 is always the nearest part to whatever is left over. the two ranges never overlap, so every part of the
+    // three decades adds at most one
+    std::array<fit, 1 + 3 * e96.size()> candidates;
+    size_t count = 0;
+    double single = nearest(ideal, s);
+    candidates[count++] = {topology::single, single, 0, single};
+    std::span<const double> m = mantissas(s);
+    double decade = pow(10, floor(log10(ideal / 2)));
+    for (int d = 0; d < 3; d++, decade *= 10) {
+      for (double mantissa : m) {
+        double first = mantissa * decade;
+        if (first >= ideal / 2 && first < ideal) {
+          double second = nearest(ideal - first, s);
+          candidates[count++] = {topology::parallel, first, second, first + second};
+        }
+        if (first > ideal && first <= 2 * ideal) {
+          double second = nearest(1 / (1 / ideal - 1 / first), s);
+          candidates[count++] = {topology::series, first, second, 1 / (1 / first + 1 / second)};
+        }
+      }
+    }
+    std::span<fit> built(candidates.data(), count);
+    for (fit& candidate : built) {
+      candidate.frequency = circuit::damped_frequency(inductance, candidate.capacitance * nanofarads, resistance);
+      candidate.cents = candidate.frequency > 0 ? cents(candidate.frequency, target) : INFINITY;
+    }
+    // fewer parts win ties, so the single capacitor goes first
+    return *std::min_element(built.begin(), built.end(), [](const fit& a, const fit& b) {
+      return abs(a.cents) < abs(b.cents);
+    });
+  }
+  scale_fit solve_scale(const tuning::table& targets, double inductance, double resistance, series s, int firstKey = 21, int lastKey = 108)
+  {
+    // the inductor is one part shared by every key, so try the preferred values on either side of the chosen one
+    // and keep whichever lets the capacitors get the whole keyboard closest in tune
+    scale_fit best{};
+    double bestError = INFINITY;
+    double closest = nearest(inductance, s);
+    double step = pow(10, 1.0 / mantissas(s).size());
+    double candidates[2] = {closest, closest < inductance ? nearest(closest * step, s) : nearest(closest / step, s)};
+    for (double candidate : candidates) {
+      scale_fit attempt{candidate};
+      const tuning::table& ideals = tuning::capacitances_for(targets, candidate, resistance);
+      double error = 0;
+      for (int key = firstKey; key <= lastKey; key++) {
+        attempt.keys[key] = fit_key(targets[key], ideals[key], candidate, resistance, s);
+        error += abs(attempt.keys[key].cents);
+      }
+      if (error < bestError) {
+        best = attempt;
+        bestError = error;
+      }
+    }
+    return best;
+  }
+  const scale_fit& solve_scale_for(const tuning::table& targets, double inductance, double resistance, series s)
+  {
+    // re-solved only when the circuit, the tuning or the series changes
+    static const tuning::table* cachedTargets = nullptr;
+    static double cachedInductance = -1, cachedResistance = -1;
+    static series cachedSeries;
+    static scale_fit cached{};
+    if (cachedTargets != &targets || cachedInductance != inductance || cachedResistance != resistance || cachedSeries != s) {
+      cached = solve_scale(targets, inductance, resistance, s);
+      cachedTargets = &targets;
+      cachedInductance = inductance;
+      cachedResistance = resistance;
+      cachedSeries = s;
+    }
+    return cached;
+  }
+  std::string describe(const fit& f)
+  {
+    auto format = [](double nF) {
+      std::ostringstream out;
+      out << std::setprecision(3);
+      if (nF >= 1000) {
+        out << nF / 1000 << " &microF";
+      } else {
+        out << nF << " nF";
+      }
+      return out.str();
+    };
+    std::ostringstream out;
+    out << format(f.first);
+    if (f.wiring == topology::parallel) {
+      out << " &#8741; " << format(f.second);
+    } else if (f.wiring == topology::series) {
+      out << " in series with " << format(f.second);
+    }
+    out << std::showpos << std::fixed << std::setprecision(1) << " (" << f.cents << " cents)";
+    return out.str();
+  }
+}
+
+// the notes of the octave selects, as keys into the tuning tables
+static const std::map<std::string, int> noteKeys = {
+  {"C4", 60},
+  {"C#", 61},
+  {"D", 62},
+  {"D#", 63},
+  {"E", 64},
+  {"F", 65},
+  {"F#", 66},
+  {"G", 67},
+  {"G#", 68},
+  {"A", 69},
+  {"A#", 70},
+  {"B", 71},
+  {"C5", 72}
 };
 
-static const double frequencyArray[13] = {261.63, 277.18, 293.66, 311.13, 329.63, 349.23, 369.99, 392.00, 415.30, 440.00, 466.16, 493.88, 523.25};
+// a step pattern as note names of the octave selects, - for a rest, like "C4 E G C5 G E C4 -"
+std::string steps_text(const engine::pattern& p)
+{
+  std::string text;
+  for (int i = 0; i < p.length; i++) {
+    std::string name = "-";
+    for (auto& [note, key] : noteKeys) {
+      if (key - noteKeys.at("C4") == p.keys[i]) {
+        name = note;
+      }
+    }
+    text += (i > 0 ? " " : "") + name;
+  }
+  return text;
+}
+void parse_steps(const std::string& text, engine::pattern& p)
+{
+  // anything that is not a note is a rest, so a half typed pattern still plays
+  std::istringstream names(text);
+  std::string name;
+  int length = 0;
+  p.keys.fill(-1);
+  while (length < engine::maxSteps && names >> name) {
+    auto note = noteKeys.find(name);
+    p.keys[length++] = note != noteKeys.end() ? note->second - noteKeys.at("C4") : -1;
+  }
+  p.length = std::max(1, length);
+}
+
+static tuning::table scalaTuning = tuning::equalTemperament;
+static const tuning::table* keyboardTuning = &tuning::equalTemperament;
+// bumped by every impulse response loaded, since the room select may already say "file"
+static int roomFileLoads = 0;
+
+namespace frame
+{
+  // transient render and sidebar data (vectors of inputs, add_rlcs arguments) is bump-allocated out of one fixed
+  // buffer that Render throws away all at once at the start of every frame, so a steady frame never touches the heap
+  struct arena : std::pmr::memory_resource
+  {
+    alignas(std::max_align_t) std::array<std::byte, 1 << 16> buffer;
+    size_t used = 0;
+    size_t highWater = 0;
+    long long overflows = 0; // requests that did not fit and went to the heap instead
+    void* do_allocate(size_t bytes, size_t alignment) override
+    {
+      size_t start = (used + alignment - 1) & ~(alignment - 1);
+      if (start + bytes > buffer.size()) {
+        overflows++;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+      }
+      used = start + bytes;
+      highWater = std::max(highWater, used);
+      return buffer.data() + start;
+    }
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override
+    {
+      // arena memory only comes back all at once in begin
+      if (p < buffer.data() || p >= buffer.data() + buffer.size()) {
+        std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+      }
+    }
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+      return this == &other;
+    }
+  };
+  arena memory;
+  // every operator new since startup. atomic because the tolerance workers allocate too
+  std::atomic<long long> heapAllocations = 0;
+  long long frameStart = 0;
+  long long lastAllocations = 0; // in the last frame
+  long long quietFrames = 0; // frames in a row without any
+  void begin()
+  {
+    // nothing from the last frame may still be alive here
+    memory.used = 0;
+    frameStart = heapAllocations.load(std::memory_order_relaxed);
+  }
+  void end()
+  {
+    lastAllocations = heapAllocations.load(std::memory_order_relaxed) - frameStart;
+    quietFrames = lastAllocations == 0 ? quietFrames + 1 : 0;
+  }
+  std::string report()
+  {
+    std::ostringstream out;
+    out << "last frame: " << lastAllocations << " heap allocations, " << quietFrames << " frames in a row without any\n"
+        << "arena: " << memory.highWater << " of " << memory.buffer.size() << " bytes at most, " << memory.overflows
+        << " requests spilled to the heap\n";
+    return out.str();
+  }
+}
 
+// counts every heap allocation the c++ side makes, see frame::report. the deletes are replaced too so they pair with malloc
+void* operator new(size_t size)
+{
+  frame::heapAllocations.fetch_add(1, std::memory_order_relaxed);
+  if (void* p = malloc(size == 0 ? 1 : size)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+void* operator new[](size_t size)
+{
+  return operator new(size);
+}
+void operator delete(void* p) noexcept
+{
+  free(p);
+}
+void operator delete[](void* p) noexcept
+{
+  free(p);
+}
+void operator delete(void* p, size_t) noexcept
+{
+  free(p);
+}
+void operator delete[](void* p, size_t) noexcept
+{
+  free(p);
+}
+
+namespace session
+{
+  // records what the user does as a compact text log and replays it headlessly against a fixed clock, see ReplaySession.
+  // while replaying, time only moves when the replay moves it
+  std::optional<double> fixedTime; // performance.now() milliseconds while replaying
+  double audioOffset = 0; // audio context seconds minus performance.now() seconds when the replay started
+  double performance_now()
+  {
+    return fixedTime ? fixedTime.value() : emscripten::val::global("performance").call<double>("now");
+  }
+  struct entry
+  {
+    double time; // ms after the recording started
+    char kind; // 'k' key, 'p' SelectPage, 'n' NextPage, 'P' PlayOrPauseSound, 'i' input field
+    std::string data; // "d 90" or "u 90" for keys, the page for SelectPage, "id value" for input fields
+  };
+  bool recording = false;
+  double recordingStart = 0;
+  std::vector<entry> log;
+  void record(char kind, std::string data)
+  {
+    // replayed events are not recorded again
+    if (recording && !fixedTime) {
+      log.push_back({performance_now() - recordingStart, kind, std::move(data)});
+    }
+  }
+  std::string serialize(const std::vector<entry>& entries)
+  {
+    // one line per event: milliseconds since the previous event to 0.1 ms, the kind, then its data
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(1);
+    double previous = 0;
+    for (const entry& e : entries) {
+      double time = round(e.time * 10) / 10;
+      out << time - previous << ' ' << e.kind;
+      if (!e.data.empty()) {
+        out << ' ' << e.data;
+      }
+      out << '\n';
+      previous = time;
+    }
+    return out.str();
+  }
+  std::vector<entry> parse(const std::string& text)
+  {
+    std::vector<entry> entries;
+    std::istringstream in(text);
+    std::string line;
+    double time = 0;
+    while (std::getline(in, line)) {
+      std::istringstream fields(line);
+      double delta;
+      char kind;
+      if (!(fields >> delta >> kind)) {
+        continue;
+      }
+      time += delta;
+      std::string data;
+      std::getline(fields >> std::ws, data);
+      entries.push_back({time, kind, data});
+    }
+    return entries;
+  }
+}
 
 void PlayOrPauseSound(emscripten::val event);
 
@@ -64,16 +581,45 @@ namespace audio
   emscripten::val globalAudioContext = emscripten::val::global("AudioContext");
   // audioContext is allowed to start only after user interactions, so this must only be created when initialized
   std::optional<emscripten::val> audioContext;
+  // every Web Audio voice goes through this one node, so anything on the bus costs the same no matter how many voices play.
+  // it also takes the engine's headroom off the mix
+  std::optional<emscripten::val> masterBus;
+  std::vector<emscripten::val> speakerStage;
+  // the end of the mix, after the speaker stage. it goes through the wasm engine when that has work, else the limiter node
+  std::optional<emscripten::val> mixOutput;
+  std::optional<emscripten::val> engineNode;
+  const int engineBufferSize = 1024; // samples per ScriptProcessorNode callback
+  bool engineConnected = false;
+  bool roomEnabled = false; // whether the last room sent to the engine has an impulse response
+  std::string roomName = "none"; // the last room set_room was given
+  // the sequencer always plays through the engine, whichever renderer the keys use, since its clock is the engine's
+  bool sequencerRunning = false;
+  engine::pattern sequencerPattern; // the last one set_sequencer sent
+  // when nothing runs through the engine its look-ahead limiter is not there either, so this one takes over
+  std::optional<emscripten::val> limiterNode;
+  // the last node before the destination, never rewired, so taps on it (like the latency probe's analyser) stay
+  std::optional<emscripten::val> outputBus;
+  // who renders the voices: oscillator and gain nodes, or engine::render_voices inside engineNode
+  enum class backend { webaudio, engine };
+  backend activeBackend = backend::webaudio;
+  // only voices that are sounding have nodes
   std::unordered_map<boost::uuids::uuid, emscripten::val, boost::hash<boost::uuids::uuid>> oscillators;
   std::unordered_map<boost::uuids::uuid, emscripten::val, boost::hash<boost::uuids::uuid>> gainNodes;
-  std::unordered_map<boost::uuids::uuid, emscripten::val, boost::hash<boost::uuids::uuid>> volumeManagers;
+  // gain nodes of finished voices, still connected to the master bus so the next note can reuse them
+  std::vector<emscripten::val> gainPool;
+  const int maxPooledGainNodes = 64;
+  std::unordered_set<boost::uuids::uuid, boost::hash<boost::uuids::uuid>> activeVoices;
   std::unordered_map<boost::uuids::uuid, double, boost::hash<boost::uuids::uuid>> timeConstants; // in seconds
   std::unordered_map<boost::uuids::uuid, double, boost::hash<boost::uuids::uuid>> beginTimes;
   std::unordered_map<boost::uuids::uuid, double, boost::hash<boost::uuids::uuid>> frequencies;
   std::unordered_map<boost::uuids::uuid, double, boost::hash<boost::uuids::uuid>> initialVolumes;
-  std::unordered_map<boost::uuids::uuid, int, boost::hash<boost::uuids::uuid>> elapsedTimeConstants;
+  // the whole e^-t/τ decay of each voice, sampled once when the voice is added and handed to setValueCurveAtTime on play
+  std::unordered_map<boost::uuids::uuid, std::vector<float>, boost::hash<boost::uuids::uuid>> envelopeCurves;
   bool initialized = false;
   bool playing = false;
+  // the curve is linearly interpolated between points, 32 per time constant keeps the error under 0.02%.
+  // it only runs until the voice falls below engine::cullThreshold, after which the voice is retired
+  const int envelopePointsPerTimeConstant = 32;
   /*
   class rlc
   {
@@ -112,30 +658,196 @@ namespace audio
       }
     }
   };*/
-  void volume_control()
+  double now()
+  {
+    // a replayed session runs on its own fixed clock, see session::replay
+    if (session::fixedTime) {
+      return session::fixedTime.value() / 1000 + session::audioOffset;
+    }
+    return audioContext.value()["currentTime"].as<double>();
+  }
+  double outputLatency = -1; // seconds from currentTime to what is being heard, averaged, negative until measured
+  double event_time(double timeStamp)
+  {
+    // the context time to play an input event at, so every key is heard the same time after it was pressed however long
+    // its event waited for us. getOutputTimestamp pairs the context time being heard with the performance.now() it is
+    // heard at, which puts the event's timeStamp on the context clock. currentTime runs ahead of that by the output
+    // latency, which is averaged because currentTime only moves a render quantum at a time. one engine buffer on top
+    // leaves the engine time to pick the command up
+    if (session::fixedTime) {
+      return timeStamp / 1000 + session::audioOffset;
+    }
+    emscripten::val stamp = audioContext.value().call<emscripten::val>("getOutputTimestamp");
+    double performanceTime = stamp["performanceTime"].as<double>();
+    if (!(performanceTime > 0)) {
+      // nothing has been heard yet
+      return now();
+    }
+    double contextTime = stamp["contextTime"].as<double>();
+    double heardNow = contextTime + (session::performance_now() - performanceTime) / 1000;
+    double latency = std::max(0.0, now() - heardNow);
+    outputLatency = outputLatency < 0 ? latency : outputLatency + 0.1 * (latency - outputLatency);
+    double heardAtEvent = contextTime + (timeStamp - performanceTime) / 1000;
+    double margin = engineBufferSize / audioContext.value()["sampleRate"].as<double>();
+    return std::max(now(), heardAtEvent + outputLatency + margin);
+  }
+  std::vector<float> compute_envelope_curve(double initialVolume)
+  {
+    // setValueCurveAtTime needs at least two points, even for a voice that will be culled anyway
+    std::vector<float> curve(std::max(2, int(ceil(engine::audible_time_constants(initialVolume) * envelopePointsPerTimeConstant)) + 1));
+    for (size_t i = 0; i < curve.size(); i++) {
+      curve[i] = initialVolume * exp(-double(i) / envelopePointsPerTimeConstant);
+    }
+    return curve;
+  }
+  double envelope_duration(boost::uuids::uuid uuid)
+  {
+    return double(envelopeCurves.at(uuid).size() - 1) / envelopePointsPerTimeConstant * timeConstants.at(uuid);
+  }
+  void start_envelope(boost::uuids::uuid uuid, double time)
+  {
+    // one automation event for the whole decay, no periodic rescheduling needed
+    // setValueCurveAtTime copies the values, so a view into wasm memory is enough
+    std::vector<float>& curve = envelopeCurves.at(uuid);
+    emscripten::val gain = gainNodes.at(uuid)["gain"];
+    gain.call<void>("cancelScheduledValues", emscripten::val(0));
+    gain.call<void>("setValueCurveAtTime",
+                    emscripten::val(emscripten::typed_memory_view(curve.size(), curve.data())),
+                    emscripten::val(time),
+                    emscripten::val(envelope_duration(uuid)));
+  }
+  void materialize_voice(boost::uuids::uuid uuid, double time)
   {
-    if (audioContext.has_value())
+    // audio nodes only exist while a voice sounds, so silent voices cost the audio thread nothing.
+    // an oscillator can only be started once, so every note gets a fresh (cheap) one, while the gain node
+    // that is already wired into the master bus comes from the pool
+    emscripten::val gainNode;
+    if (gainPool.empty()) {
+      gainNode = audioContext.value().call<emscripten::val>("createGain");
+      gainNode.call<void>("connect", masterBus.value());
+    } else {
+      gainNode = gainPool.back();
+      gainPool.pop_back();
+    }
+    emscripten::val oscillator = audioContext.value().call<emscripten::val>("createOscillator");
+    oscillator.set("type", emscripten::val("sine"));
+    oscillator["frequency"].set("value", emscripten::val(frequencies.at(uuid)));
+    oscillator.call<void>("connect", gainNode);
+    oscillator.call<void>("start", emscripten::val(time));
+    // stops on its own when the decay is over, even before reclaim_finished_voices gets to it
+    oscillator.call<void>("stop", emscripten::val(time + envelope_duration(uuid)));
+    oscillators.insert_or_assign(uuid, oscillator);
+    gainNodes.insert_or_assign(uuid, gainNode);
+    activeVoices.emplace(uuid);
+  }
+  size_t engine_id(boost::uuids::uuid uuid)
+  {
+    return boost::hash<boost::uuids::uuid>()(uuid);
+  }
+  long long engine_sample(double time)
+  {
+    return llround(time * engine::sampleRate);
+  }
+  bool send(const engine::command& c)
+  {
+    // false when the queue is full and the command was dropped. whatever it carried is still the caller's to free,
+    // and the caller keeps its old state so the change is tried again.
+    // while the engine node is unpatched nothing drains the queue, so this thread stands in for the renderer.
+    // nothing else can be running process then: the browser only calls it from this thread, between our events
+    bool sent = engine::push(engine::commands, c);
+    if (!sent) {
+      std::cout << "Error: the engine command queue is full\n";
+    }
+    if (!engineConnected) {
+      engine::poll_telemetry();
+      engine::apply_commands();
+      engine::poll_telemetry();
+    }
+    return sent;
+  }
+  void release_voice(boost::uuids::uuid uuid, double time)
+  {
+    if (activeBackend == backend::engine) {
+      // a voice the engine was not told to stop is still sounding
+      if (send({.type = engine::command::kind::stop_voice, .id = engine_id(uuid), .sample = engine_sample(time)})) {
+        activeVoices.erase(uuid);
+      }
+      return;
+    }
+    emscripten::val gainNode = gainNodes.at(uuid);
+    gainNode["gain"].call<void>("cancelScheduledValues", emscripten::val(0));
+    gainNode["gain"].call<void>("setValueAtTime", emscripten::val(0), emscripten::val(time));
+    oscillators.at(uuid).call<void>("stop", emscripten::val(time));
+    oscillators.at(uuid).call<void>("disconnect");
+    if (gainPool.size() < maxPooledGainNodes) {
+      gainPool.emplace_back(gainNode);
+    } else {
+      gainNode.call<void>("disconnect");
+    }
+    oscillators.erase(uuid);
+    gainNodes.erase(uuid);
+    activeVoices.erase(uuid);
+  }
+  void reclaim_finished_voices()
+  {
+    // returns the nodes of voices whose decay has run out to the pool, called once a frame
+    if (!initialized)
     {
-      for (auto& [uuid, gainNode] : gainNodes) {
-        // time after play() in seconds. add one TIME_CONSTANT since this is the time at the end of the exponentialRampToValueAtTime
-        double offsetTime = audioContext.value()["currentTime"].as<double>() - beginTimes.at(uuid);
-        // rounding isn't very accurate but so is TimeInterval TODO
-        if (round(offsetTime / timeConstants.at(uuid)) == elapsedTimeConstants.at(uuid)) {
-          elapsedTimeConstants.at(uuid) = round(offsetTime / timeConstants.at(uuid)) + 1;
-          if (pow(e, -elapsedTimeConstants.at(uuid)) >
-              2 * pow(10, -45)) // can't exponentialRampToValueAtTime to 0 if timeConstants is too high
-          {
-            std::cout << offsetTime << " sec to " << offsetTime + timeConstants.at(uuid) << " sec: decrease to volume of "
-                      << 100 * pow(e, -elapsedTimeConstants.at(uuid)) << "% (e^-" << elapsedTimeConstants.at(uuid) << ") from volume "
-                      << gainNodes.at(uuid)["gain"]["value"].as<double>() << " at " << elapsedTimeConstants.at(uuid)
-                      << " time constants\n";
-            gainNode["gain"].call<void>("setValueAtTime", gainNode["gain"]["value"],
-                                                audioContext.value()["currentTime"]);
-            gainNode["gain"].call<emscripten::val>("exponentialRampToValueAtTime",
-                                                           emscripten::val(initialVolumes.at(uuid) * pow(e, -elapsedTimeConstants.at(uuid))),
-                                                           emscripten::val(beginTimes.at(uuid) + offsetTime + timeConstants.at(uuid)));
-          }
+      return;
+    }
+    double currentTime = now();
+    std::vector<boost::uuids::uuid> finished;
+    for (auto& uuid : activeVoices)
+    {
+      if (currentTime >= beginTimes.at(uuid) + envelope_duration(uuid)) {
+        finished.emplace_back(uuid);
+      }
+    }
+    for (auto& uuid : finished)
+    {
+      release_voice(uuid, currentTime);
+      // the engine counts its own when render_voices drops them
+      if (activeBackend == backend::webaudio) {
+        engine::culled.retired++;
+      }
+    }
+  }
+  void play(std::span<const boost::uuids::uuid> rlcUuids, double time)
+  {
+    for (auto& uuid : rlcUuids) {
+      // pressing an already sounding key restarts its decay
+      if (activeVoices.contains(uuid)) {
+        release_voice(uuid, time);
+      }
+      beginTimes.insert_or_assign(uuid, time);
+      playing = true;
+      if (activeBackend == backend::engine) {
+        std::optional<engine::voice> v = engine::make_voice(engine_id(uuid), frequencies.at(uuid), initialVolumes.at(uuid),
+                                                            timeConstants.at(uuid), engine_sample(time));
+        if (v && send({.type = engine::command::kind::start_voice, .started = v.value()})) {
+          activeVoices.emplace(uuid);
         }
+        continue;
+      }
+      // same culling as engine::make_voice, so the nodes of inaudible partials are never created
+      if (!engine::audible_frequency(frequencies.at(uuid))) {
+        engine::culled.aboveHearing++;
+        continue;
+      }
+      if (engine::audible_time_constants(initialVolumes.at(uuid)) <= 0) {
+        engine::culled.belowThreshold++;
+        continue;
+      }
+      materialize_voice(uuid, time);
+      start_envelope(uuid, time);
+    }
+  }
+  void stop(std::span<const boost::uuids::uuid> rlcUuids, double time)
+  {
+    for (auto& uuid : rlcUuids) {
+      if (activeVoices.contains(uuid)) {
+        release_voice(uuid, time);
+        playing = false;
       }
     }
   }
@@ -147,31 +859,17 @@ namespace audio
       // emscripten currently does not have much support for throwing std::exception
       std::cout << "Error: audio::play() called before audio::initialize()\n";
     }
-    emscripten::val currentTime = audioContext.value()["currentTime"];
+    double currentTime = now();
     if (playing)
     {
       // stop
-      for (auto& [uuid, oscillator] : oscillators) {
-        gainNodes.at(uuid)["gain"].call<void>("cancelScheduledValues", currentTime);
-        oscillators.at(uuid).call<void>("disconnect", gainNodes.at(uuid));
-        if (volumeManagers.contains(uuid)) {
-          window.call<void>("clearInterval", volumeManagers.at(uuid));
-        }
-        elapsedTimeConstants.at(uuid) = 0;
-        playing = false;
-      }
-      volumeManagers.clear();
+      std::vector<boost::uuids::uuid> sounding(activeVoices.begin(), activeVoices.end());
+      stop(sounding, currentTime);
+      playing = false;
     } else {
       // play
-      for (auto& [uuid, oscillator] : oscillators) {
-        oscillators.at(uuid).call<void>("connect", gainNodes.at(uuid));
-        beginTimes.at(uuid) = currentTime.as<double>();
-        gainNodes.at(uuid)["gain"].set("value", emscripten::val(initialVolumes.at(uuid)));
-        volume_control();
-        volumeManagers.try_emplace(uuid,
-                window.call<emscripten::val>("setInterval", emscripten::val::module_property("VolumeControl"),
-                                             emscripten::val(timeConstants.at(uuid) * 1000)));
-        playing = true;
+      for (auto& [uuid, frequency] : frequencies) {
+        play(std::span<const boost::uuids::uuid>(&uuid, 1), currentTime);
       }
     }
   }
@@ -183,55 +881,48 @@ namespace audio
       // emscripten currently does not have much support for throwing std::exception
       std::cout << "Error: audio::play() called before audio::initialize()\n";
     }
-    emscripten::val currentTime = audioContext.value()["currentTime"];
+    double currentTime = now();
     for (auto& uuid : rlcUuids) {
-      if (volumeManagers.contains(uuid)) {
-        // stop
-        gainNodes.at(uuid)["gain"].call<void>("cancelScheduledValues", currentTime);
-        oscillators.at(uuid).call<void>("disconnect", gainNodes.at(uuid));
-        window.call<void>("clearInterval", volumeManagers.at(uuid));
-        volumeManagers.erase(uuid);
-        elapsedTimeConstants.at(uuid) = 0;
-        playing = false;
+      if (activeVoices.contains(uuid)) {
+        stop(std::span<const boost::uuids::uuid>(&uuid, 1), currentTime);
       } else {
-        // play
-        oscillators.at(uuid).call<void>("connect", gainNodes.at(uuid));
-        beginTimes.at(uuid) = audioContext.value()["currentTime"].as<double>();
-        gainNodes.at(uuid)["gain"].set("value", emscripten::val(initialVolumes.at(uuid)));
-        volume_control();
-        volumeManagers.try_emplace(uuid,
-                                   window.call<emscripten::val>("setInterval",
-                                                                emscripten::val::module_property("VolumeControl"),
-                                                                emscripten::val(timeConstants.at(uuid) * 1000)));
-        playing = true;
+        play(std::span<const boost::uuids::uuid>(&uuid, 1), currentTime);
       }
     }
   }
-  void add_rlcs(std::unordered_map<boost::uuids::uuid, std::tuple<double, double, double>, boost::hash<boost::uuids::uuid>>& frequenciesStartingVolumesTimeConstants)
+  // voices of every key, in order of their harmonic
+  std::vector<std::vector<boost::uuids::uuid>> keyboardVoices;
+  void play_key(int key, int partials, bool on, double timeStamp)
   {
-    if (initialized)
+    // a note on or off for the key event at timeStamp, in performance.now() milliseconds. the voices are started or
+    // released at the event's own time: the engine gets it as the sample of its start_voice and stop_voice commands, and
+    // Web Audio as the time of start and setValueAtTime. partials is how many of the key's voices sound, 1 for a sine
+    // and all of them for a sawtooth
+    if (!initialized || key < 0 || key >= int(keyboardVoices.size())) {
+      return;
+    }
+    double time = event_time(timeStamp);
+    std::vector<boost::uuids::uuid>& voices = keyboardVoices.at(key);
+    if (on) {
+      play(std::span<const boost::uuids::uuid>(voices.data(), std::min<size_t>(partials, voices.size())), time);
+    } else {
+      // the waveform may have been switched while the key was held, so release every partial
+      stop(voices, time);
+    }
+  }
+  // uuid -> (frequency, initial volume, time constant). polymorphic so the sidebar can build them in the frame arena
+  using rlc_map = std::pmr::unordered_map<boost::uuids::uuid, std::tuple<double, double, double>, boost::hash<boost::uuids::uuid>>;
+  void add_rlcs(const rlc_map& frequenciesStartingVolumesTimeConstants)
+  {
+    // only the parameters are stored here, the audio nodes are created when the voice is first played
+    for (auto& [uuid, tuple] : frequenciesStartingVolumesTimeConstants)
     {
-      emscripten::val time = audioContext.value()["currentTime"];
-      for (auto& [uuid, tuple] : frequenciesStartingVolumesTimeConstants)
-      {
-        auto [frequency, startingVolume, timeConstant] = tuple;
-        emscripten::val oscillator = audioContext.value().call<emscripten::val>("createOscillator");
-        oscillator.set("type", emscripten::val("sine"));
-        oscillator["frequency"].set("value", emscripten::val(frequency));
-        oscillators.try_emplace(uuid, oscillator);
-        emscripten::val gainNode = audioContext.value().call<emscripten::val>("createGain");
-        gainNodes.try_emplace(uuid, gainNode);
-        gainNode.call<void>("connect", audioContext.value()["destination"]);
-        timeConstants.try_emplace(uuid, timeConstant);
-        frequencies.try_emplace(uuid, frequency);
-        initialVolumes.try_emplace(uuid, startingVolume);
-        elapsedTimeConstants.try_emplace(uuid, 0);
-      }
-      double currentTime = audioContext.value()["currentTime"].as<double>();
-      for (auto& [uuid, tuple] : frequenciesStartingVolumesTimeConstants) {
-        beginTimes.try_emplace(uuid, currentTime);
-        oscillators.at(uuid).call<void>("start");
-      }
+      auto [frequency, startingVolume, timeConstant] = tuple;
+      timeConstants.try_emplace(uuid, timeConstant);
+      frequencies.try_emplace(uuid, frequency);
+      initialVolumes.try_emplace(uuid, startingVolume);
+      beginTimes.try_emplace(uuid, 0);
+      envelopeCurves.try_emplace(uuid, compute_envelope_curve(startingVolume));
     }
   }
   std::unordered_map<boost::uuids::uuid, std::tuple<double, double, double>, boost::hash<boost::uuids::uuid>> remove_rlcs(std::vector<boost::uuids::uuid>& rlcUuids)
@@ -239,44 +930,39 @@ namespace audio
     std::unordered_map<boost::uuids::uuid, std::tuple<double, double, double>, boost::hash<boost::uuids::uuid>> ans;
     for (auto& uuid : rlcUuids) {
       ans.try_emplace(uuid, std::make_tuple(frequencies.at(uuid), initialVolumes.at(uuid), timeConstants.at(uuid)));
-      if (volumeManagers.contains(uuid))
+      if (activeVoices.contains(uuid))
       {
-        oscillators.at(uuid).call<void>("disconnect", gainNodes.at(uuid));
-        window.call<void>("clearInterval", volumeManagers.at(uuid));
-        volumeManagers.erase(uuid);
-      }
-      oscillators.at(uuid).call<void>("stop");
-      oscillators.erase(uuid);
-      gainNodes.at(uuid).call<void>("disconnect");
-      gainNodes.erase(uuid);
+        release_voice(uuid, now());
+      }
       timeConstants.erase(uuid);
       beginTimes.erase(uuid);
       frequencies.erase(uuid);
       initialVolumes.erase(uuid);
-      elapsedTimeConstants.erase(uuid);
+      envelopeCurves.erase(uuid);
     }
     return ans;
   }
-  void remove_all_rlcs()
+  void set_cull_threshold(double threshold)
   {
-    for (auto& [uuid, volumeManager] : volumeManagers)
+    // in dBFS. the envelopes are cut where the voices cross it, so all of them are resampled
+    engine::cullThreshold = threshold;
+    for (auto& [uuid, curve] : envelopeCurves)
     {
-      oscillators.at(uuid).call<void>("disconnect", gainNodes.at(uuid));
-      window.call<void>("clearInterval", volumeManagers.at(uuid));
+      curve = compute_envelope_curve(initialVolumes.at(uuid));
     }
-    volumeManagers.clear();
-    for (auto& [uuid, oscillator] : oscillators)
+  }
+  void remove_all_rlcs()
+  {
+    std::vector<boost::uuids::uuid> sounding(activeVoices.begin(), activeVoices.end());
+    for (auto& uuid : sounding)
     {
-      oscillator.call<void>("stop");
-      gainNodes.at(uuid).call<void>("disconnect");
+      release_voice(uuid, now());
     }
-    oscillators.clear();
-    gainNodes.clear();
     timeConstants.clear();
     beginTimes.clear();
     frequencies.clear();
     initialVolumes.clear();
-    elapsedTimeConstants.clear();
+    envelopeCurves.clear();
   }
   bool get_playing()
   {
@@ -284,7 +970,7 @@ namespace audio
   }
   bool get_rlc_playing(boost::uuids::uuid uuid)
   {
-    return volumeManagers.contains(uuid);
+    return activeVoices.contains(uuid);
   }
   std::unordered_map<boost::uuids::uuid, double, boost::hash<boost::uuids::uuid>>& get_frequencies()
   {
@@ -298,41 +984,152 @@ namespace audio
   {
     return timeConstants;
   }
-  double get_current_volume(boost::uuids::uuid uuid)
+  using circuit::damping;
+  using circuit::rlc_response;
+  using circuit::solve_rlc;
+  using circuit::damped_frequency;
+  using circuit::rlc_currents;
+  void series_response(double inductance, double capacitance, double resistance, std::span<const double> frequencies,
+                       std::span<double> decibels, std::span<double> degrees)
+  {
+    // the current per volt of drive at every frequency, I/V = 1/Z with Z = R + j(ωL - 1/ωC). the magnitude is relative
+    // to its peak of 1/R at resonance. the complex arithmetic runs two frequencies per 128-bit vector, only the log
+    // and the angle are per lane
+    typedef double pair __attribute__((vector_size(16)));
+    size_t n = 0;
+    auto finish = [&](size_t i, double re, double im) {
+      decibels[i] = 10 * fastmath::log10(std::max(resistance * re, 1e-300)); // |Y|² R² = R Re(Y)
+      degrees[i] = atan2(im, re) * 180 / pi;
+    };
+    for (; n + 2 <= frequencies.size(); n += 2) {
+      pair omega;
+      __builtin_memcpy(&omega, &frequencies[n], sizeof(omega));
+      omega *= 2*pi;
+      pair reactance = omega * inductance - 1 / (omega * capacitance);
+      pair magnitude = resistance * resistance + reactance * reactance;
+      pair re = resistance / magnitude, im = -reactance / magnitude;
+      finish(n, re[0], im[0]);
+      finish(n + 1, re[1], im[1]);
+    }
+    for (; n < frequencies.size(); n++) {
+      double omega = 2*pi * frequencies[n];
+      double reactance = omega * inductance - 1 / (omega * capacitance);
+      double magnitude = resistance * resistance + reactance * reactance;
+      finish(n, resistance / magnitude, -reactance / magnitude);
+    }
+  }
+  double get_current_volume(boost::uuids::uuid uuid, double time)
   {
-    if (volumeManagers.contains(uuid)) {
-      return initialVolumes.at(uuid) * pow(e, -((audioContext.value()["currentTime"].as<double>() - beginTimes.at(uuid)) / timeConstants.at(uuid)));
+    if (activeVoices.contains(uuid)) {
+      return initialVolumes.at(uuid) * fastmath::exp(-((time - beginTimes.at(uuid)) / timeConstants.at(uuid)));
     } else {
       return 0;
     }
   }
+  double get_current_volume(boost::uuids::uuid uuid)
+  {
+    return get_current_volume(uuid, now());
+  }
   double get_current()
   {
+    static std::vector<rlc_response> responses;
+    static std::vector<double> times;
+    static std::vector<double> currents;
+    double time = now();
+    responses.clear();
+    times.clear();
+    for (auto& uuid : activeVoices)
+    {
+      responses.emplace_back(solve_rlc(frequencies.at(uuid), initialVolumes.at(uuid), timeConstants.at(uuid)));
+      times.emplace_back(time - beginTimes.at(uuid));
+    }
+    currents.resize(responses.size());
+    rlc_currents(responses, times, currents);
     double temp = 0.0;
-    for (auto& [uuid, volumeManager] : volumeManagers)
+    for (double current : currents)
     {
-      temp += get_current_volume(uuid) * sin(2*pi*frequencies.at(uuid)*(audioContext.value()["currentTime"].as<double>() - beginTimes.at(uuid)));
+      temp += current;
     }
     return temp;
   }
   double get_slowed_current()
   {
+    double time = now();
     double temp = 0.0;
-    for (auto& [uuid, volumeManager] : volumeManagers)
+    for (auto& uuid : activeVoices)
     {
-      temp += get_current_volume(uuid) * sin((2*pi*frequencies.at(uuid)*audioContext.value()["currentTime"].as<double>() - beginTimes.at(uuid))/100);
+      temp += get_current_volume(uuid, time) * fastmath::sin((2*pi*frequencies.at(uuid)*time - beginTimes.at(uuid))/100);
     }
     return temp;
   }
+  double get_peak_current(double time)
+  {
+    // upper bound on |get_current()| from time on, used to scale scope traces. a voice that starts later is at its
+    // loudest when it starts, not before
+    double temp = 0.0;
+    for (auto& uuid : activeVoices)
+    {
+      temp += get_current_volume(uuid, std::max(time, beginTimes.at(uuid)));
+    }
+    return temp;
+  }
+  void sample_current(double startTime, double dt, std::span<double> out)
+  {
+    // evaluates the summed current at startTime + i*dt for every i in out
+    // each voice is a phasor rotated and shrunk by the same factor every step, so there are no sin/exp calls per point,
+    // and the voice loop is innermost over flat arrays so it vectorizes across voices.
+    // a voice that starts inside the window is silent until its first point, and its phasor starts from there
+    static std::vector<double> re, im, stepRe, stepIm, first;
+    re.clear();
+    im.clear();
+    stepRe.clear();
+    stepIm.clear();
+    first.clear();
+    for (auto& uuid : activeVoices)
+    {
+      double omega = 2*pi*frequencies.at(uuid);
+      double begin = beginTimes.at(uuid);
+      double start = begin > startTime ? ceil((begin - startTime) / dt) : 0;
+      double offset = startTime + start * dt - begin;
+      double amplitude = initialVolumes.at(uuid) * fastmath::exp(-offset / timeConstants.at(uuid));
+      double decay = fastmath::exp(-dt / timeConstants.at(uuid));
+      re.emplace_back(amplitude * fastmath::cos(omega * offset));
+      im.emplace_back(amplitude * fastmath::sin(omega * offset));
+      stepRe.emplace_back(decay * fastmath::cos(omega * dt));
+      stepIm.emplace_back(decay * fastmath::sin(omega * dt));
+      first.emplace_back(start);
+    }
+    size_t voices = re.size();
+    double* __restrict r = re.data();
+    double* __restrict i = im.data();
+    const double* __restrict sr = stepRe.data();
+    const double* __restrict si = stepIm.data();
+    const double* __restrict f = first.data();
+    for (size_t n = 0; n < out.size(); n++)
+    {
+      double sum = 0.0;
+      for (size_t v = 0; v < voices; v++)
+      {
+        // selects rather than branches, so the loop still vectorizes
+        bool started = n >= f[v];
+        sum += started ? i[v] : 0.0;
+        double nextRe = r[v] * sr[v] - i[v] * si[v];
+        double nextIm = r[v] * si[v] + i[v] * sr[v];
+        r[v] = started ? nextRe : r[v];
+        i[v] = started ? nextIm : i[v];
+      }
+      out[n] = sum;
+    }
+  }
   double get_example_current()
   {
     // always playes a 440 Hz sound at a volume of 1 and slows it down by a factor of 1,000 (performace.now() is in milliseconds)
-    return sin(2*pi*440*(emscripten::val::global("performance").call<emscripten::val>("now").as<double>()/1000)/1000);
+    return sin(2*pi*440*(session::performance_now()/1000)/1000);
   }
   double get_example_rc_current()
   {
     // always plays a 440 Hz sound at a volume of 1 and slows it down by a time constant of 5.0 seconds
-    double currentTime = emscripten::val::global("performance").call<emscripten::val>("now").as<double>()/1000;
+    double currentTime = session::performance_now()/1000;
     double cycle = fmod(currentTime, 5.0);
     if (cycle > 4.0)
     {
@@ -344,7 +1141,7 @@ namespace audio
   double get_slowed_example_rc_current()
   {
     // always plays a 440 Hz sound at a volume of 1 and slows it down by a time constant of 5.0 seconds
-    double currentTime = emscripten::val::global("performance").call<emscripten::val>("now").as<double>()/1000;
+    double currentTime = session::performance_now()/1000;
     double cycle = fmod(currentTime, 5.0);
     if (cycle > 4.0)
     {
@@ -353,6 +1150,48 @@ namespace audio
       return sin(2*pi*440*(currentTime/100)) * pow(e, -cycle);
     }
   }
+  void connect_output()
+  {
+    // mixOutput -> engineNode or limiterNode -> outputBus, rewired whenever engineConnected changes
+    mixOutput.value().call<void>("disconnect");
+    limiterNode.value().call<void>("disconnect");
+    if (engineNode)
+    {
+      engineNode.value().call<void>("disconnect");
+    }
+    emscripten::val previous = mixOutput.value();
+    if (engineConnected)
+    {
+      previous.call<void>("connect", engineNode.value());
+      previous = engineNode.value();
+    } else {
+      previous.call<void>("connect", limiterNode.value());
+      previous = limiterNode.value();
+    }
+    previous.call<void>("connect", outputBus.value());
+  }
+  void update_engine()
+  {
+    // a ScriptProcessorNode costs a buffer of latency and main thread time, so it is only patched in while the engine has work
+    bool needed = activeBackend == backend::engine || roomEnabled || sequencerRunning;
+    if (!initialized || needed == engineConnected)
+    {
+      return;
+    }
+    if (!engineNode)
+    {
+      engineNode.emplace(audioContext.value().call<emscripten::val>("createScriptProcessor", engineBufferSize, 1, 1));
+      engineNode.value().set("onaudioprocess", emscripten::val::module_property("ProcessAudio"));
+    }
+    engineConnected = needed;
+    connect_output();
+    if (!engineConnected)
+    {
+      // whatever was sent before the last callback would otherwise wait for the engine to come back
+      engine::apply_commands();
+      engine::poll_telemetry();
+    }
+  }
   void initialize()
   {
     // because you cannot create audioContext until user interaction with the page, a rule enforced by browsers
@@ -360,7 +1199,27 @@ namespace audio
     {
       emscripten::val baseAudioContext = globalAudioContext.new_();
       audioContext.emplace(baseAudioContext);
+      masterBus.emplace(audioContext.value().call<emscripten::val>("createGain"));
+      mixOutput.emplace(audioContext.value().call<emscripten::val>("createGain"));
+      masterBus.value()["gain"].set("value", emscripten::val(engine::headroom));
+      masterBus.value().call<void>("connect", mixOutput.value());
+      limiterNode.emplace(audioContext.value().call<emscripten::val>("createDynamicsCompressor"));
+      limiterNode.value()["threshold"].set("value", emscripten::val(-1));
+      limiterNode.value()["knee"].set("value", emscripten::val(0));
+      limiterNode.value()["ratio"].set("value", emscripten::val(20));
+      limiterNode.value()["attack"].set("value", emscripten::val(0));
+      limiterNode.value()["release"].set("value", emscripten::val(0.08));
+      outputBus.emplace(audioContext.value().call<emscripten::val>("createGain"));
+      outputBus.value().call<void>("connect", audioContext.value()["destination"]);
+      engine::sampleRate = audioContext.value()["sampleRate"].as<double>();
       initialized = true;
+      connect_output();
+      update_engine();
+      // the mixer's blocks and limiter are made here, so the engine node never allocates while it renders
+      std::unique_ptr<engine::mixer_buffers> buffers = engine::make_buffers(engineBufferSize);
+      if (send({.type = engine::command::kind::set_buffers, .buffers = buffers.get()})) {
+        buffers.release();
+      }
     }
   }
   double watts_to_decibels(double power, double distance)
@@ -370,7 +1229,8 @@ namespace audio
     // assumes reference sound pressure (human hearing threshold) is 20 μPa
     // also assumes the listener's eardrums are perfectly perpendicular to the sound
     double soundPressure = sqrt((power*1.2923*343)/(4*pi*distance*distance));
-    return 20*log10(soundPressure/(20*pow(10,-6)));
+    // fastmath::log10 does not handle 0, which is silence
+    return soundPressure > 0 ? 20*fastmath::log10(soundPressure/(20*pow(10,-6))) : -INFINITY;
   }
   double decibels_to_watts(double soundPressureLevel, double distance)
   {
@@ -381,10 +1241,609 @@ namespace audio
     double soundPressure = pow(10, soundPressureLevel/20) * 20*pow(10,-6);
     return (4*pi*distance*distance*pow(soundPressure,2))/(1.2923*343);
   }
+  struct speaker_parameters
+  {
+    // Thiele-Small parameters of the driver
+    double resistance; // Re, voice coil DC resistance in Ω
+    double inductance; // Le, voice coil inductance in H
+    double resonance; // fs, cone resonance in Hz
+    double mechanicalQ; // Qms
+    double electricalQ; // Qes
+  };
+  struct biquad
+  {
+    // y[n] = b0 x[n] + b1 x[n-1] + b2 x[n-2] - a1 y[n-1] - a2 y[n-2], a0 normalized to 1
+    double b0, b1, b2, a1, a2;
+  };
+  std::complex<double> speaker_impedance(const speaker_parameters& speaker, double frequency)
+  {
+    // voice coil in series with the motional impedance, which peaks at Res = Re*Qms/Qes at resonance
+    double motionalResistance = speaker.resistance * speaker.mechanicalQ / speaker.electricalQ;
+    std::complex<double> motional = motionalResistance /
+            std::complex<double>(1, speaker.mechanicalQ * (frequency / speaker.resonance - speaker.resonance / frequency));
+    return std::complex<double>(speaker.resistance, 2*pi*frequency*speaker.inductance) + motional;
+  }
+  std::array<biquad, 2> design_speaker_stage(const speaker_parameters& speaker, double sampleRate)
+  {
+    // the cone rolls the bass off like a second order highpass at fs with Q = Qts,
+    // and the voice coil inductance rolls the treble off above Re/(2πLe)
+    std::array<biquad, 2> stage;
+    double totalQ = speaker.mechanicalQ * speaker.electricalQ / (speaker.mechanicalQ + speaker.electricalQ);
+    double w0 = 2*pi*speaker.resonance / sampleRate;
+    double alpha = sin(w0) / (2 * totalQ);
+    double a0 = 1 + alpha;
+    stage[0] = {(1 + cos(w0)) / 2 / a0, -(1 + cos(w0)) / a0, (1 + cos(w0)) / 2 / a0, -2 * cos(w0) / a0, (1 - alpha) / a0};
+    // first order, bilinear transform prewarped to the corner frequency
+    double corner = std::min(speaker.resistance / (2*pi*speaker.inductance), 0.49 * sampleRate);
+    double k = tan(pi * corner / sampleRate);
+    stage[1] = {k / (k + 1), k / (k + 1), 0, (k - 1) / (k + 1), 0};
+    return stage;
+  }
+  double speaker_response(const std::array<biquad, 2>& stage, double frequency, double sampleRate)
+  {
+    // magnitude of the cascade at frequency, in dB
+    std::complex<double> z = std::polar(1.0, -2*pi*frequency / sampleRate);
+    std::complex<double> response = 1;
+    for (const biquad& section : stage)
+    {
+      response *= (section.b0 + section.b1 * z + section.b2 * z * z) / (1.0 + section.a1 * z + section.a2 * z * z);
+    }
+    return 20 * log10(abs(response));
+  }
+  bool set_speaker_stage(bool enabled, const speaker_parameters& speaker)
+  {
+    // the cascade is compiled into fixed IIR filter nodes right after the master bus. false when the engine's copy
+    // could not be sent
+    if (!initialized)
+    {
+      return true;
+    }
+    // only undo our own connection, other taps on the bus (like the latency probe's analyser) stay
+    masterBus.value().call<void>("disconnect", speakerStage.empty() ? mixOutput.value() : speakerStage.front());
+    for (auto& node : speakerStage)
+    {
+      node.call<void>("disconnect");
+    }
+    speakerStage.clear();
+    emscripten::val previous = masterBus.value();
+    auto sections = std::make_unique<std::vector<engine::biquad_section>>();
+    if (enabled)
+    {
+      for (const biquad& section : design_speaker_stage(speaker, audioContext.value()["sampleRate"].as<double>()))
+      {
+        sections->push_back({section.b0, section.b1, section.b2, section.a1, section.a2});
+        std::vector<double> feedforward = {section.b0, section.b1, section.b2};
+        std::vector<double> feedback = {1, section.a1, section.a2};
+        emscripten::val node = audioContext.value().call<emscripten::val>("createIIRFilter",
+                                                                          emscripten::val::array(feedforward),
+                                                                          emscripten::val::array(feedback));
+        previous.call<void>("connect", node);
+        speakerStage.emplace_back(node);
+        previous = node;
+      }
+    }
+    previous.call<void>("connect", mixOutput.value());
+    if (!send({.type = engine::command::kind::set_speaker, .sections = sections.get()})) {
+      return false;
+    }
+    sections.release();
+    return true;
+  }
+  bool set_room(const std::string& room)
+  {
+    // "none", "small", "hall" or "file"; the impulse response is rebuilt at the context's sample rate.
+    // false when it could not be sent, and the old room stays
+    if (!initialized)
+    {
+      return true;
+    }
+    double sampleRate = audioContext.value()["sampleRate"].as<double>();
+    std::vector<double> impulse;
+    if (room == "small") {
+      impulse = engine::synthetic_room(0.5, sampleRate);
+    } else if (room == "hall") {
+      impulse = engine::synthetic_room(2.0, sampleRate);
+    } else if (room == "file" && engine::roomFile) {
+      impulse = engine::resample(engine::roomFile->samples, engine::roomFile->sampleRate, sampleRate);
+    }
+    std::unique_ptr<engine::partitioned_convolver> convolver;
+    if (!impulse.empty()) {
+      engine::normalize(impulse);
+      convolver = std::make_unique<engine::partitioned_convolver>(engine::make_convolver(impulse, engine::partitionSize));
+    }
+    if (!send({.type = engine::command::kind::set_room, .room = convolver.get()})) {
+      return false;
+    }
+    roomEnabled = convolver != nullptr;
+    roomName = room;
+    convolver.release();
+    update_engine();
+    return true;
+  }
+  std::string backend_name()
+  {
+    if (activeBackend == backend::webaudio) {
+      return "webaudio";
+    }
+    return engine::renderPrecision == engine::precision::float32 ? "engine32" : "engine";
+  }
+  void set_backend(const std::string& name)
+  {
+    // "webaudio", "engine" or "engine32" for the engine rendering in float
+    backend requested = name == "webaudio" ? backend::webaudio : backend::engine;
+    if (requested == backend::engine)
+    {
+      // the precision can change under sounding voices, they are re-derived every block anyway
+      engine::precision requestedPrecision = name == "engine32" ? engine::precision::float32 : engine::precision::float64;
+      if (requestedPrecision != engine::renderPrecision &&
+          send({.type = engine::command::kind::set_precision, .renderPrecision = requestedPrecision}))
+      {
+        engine::renderPrecision = requestedPrecision;
+      }
+    }
+    if (requested == activeBackend)
+    {
+      return;
+    }
+    // voices can only be stopped by the backend that started them
+    if (initialized)
+    {
+      std::vector<boost::uuids::uuid> sounding(activeVoices.begin(), activeVoices.end());
+      stop(sounding, now());
+    }
+    activeBackend = requested;
+    update_engine();
+  }
+  void set_sequencer(const engine::pattern& sequence, bool running)
+  {
+    // what could not be sent stays different from what the page shows, so the next frame sends it again
+    if (!(sequence == sequencerPattern) && send({.type = engine::command::kind::set_pattern, .sequence = sequence})) {
+      sequencerPattern = sequence;
+    }
+    // from the next sample the engine renders, the ui's idea of now is a buffer behind it
+    if (running != sequencerRunning &&
+        send({.type = engine::command::kind::transport, .sample = initialized ? engine_sample(now()) : 0, .run = running})) {
+      sequencerRunning = running;
+      update_engine();
+    }
+  }
+  bool arpeggiating()
+  {
+    return sequencerRunning && sequencerPattern.play != engine::pattern::order::steps;
+  }
+  void hold_keys(const std::vector<bool>& keys)
+  {
+    uint32_t held = 0;
+    for (int key = 0; key < std::min<int>(keys.size(), 32); key++) {
+      held |= uint32_t(keys[key]) << key;
+    }
+    send({.type = engine::command::kind::hold_keys, .held = held});
+  }
+}
+
+void InteractWithKeyboard(emscripten::val event); // forward declaration
+
+namespace latency
+{
+  // measures keydown -> audible sound by feeding synthetic key events through InteractWithKeyboard
+  // and watching the output for the first non-zero sample. run it from the console on page 7A with
+  // Module.RunLatencyProbe(100)
+  std::map<std::string, std::vector<double>> results; // backend -> latencies in ms
+  std::optional<emscripten::val> analyser, analyserArray;
+  std::vector<float> analyserData;
+  int remaining = 0;
+  int probeKey = 0;
+  bool outstanding = false;
+  double eventTime = 0; // performance.now() of the injected keydown
+  int quietFrames = 0;
+  const int framesBetweenProbes = 10;
+  const double timeout = 1000; // in ms
+  std::string backend()
+  {
+    return audio::backend_name();
+  }
+  void inject(std::string type, int key, double timeStamp)
+  {
+    emscripten::val event = emscripten::val::object();
+    event.set("type", emscripten::val(type));
+    event.set("keyCode", emscripten::val(pianoKeyCodes.at(key)));
+    event.set("repeat", emscripten::val(false));
+    event.set("timeStamp", emscripten::val(timeStamp));
+    InteractWithKeyboard(event);
+  }
+  double percentile(std::vector<double> values, double fraction)
+  {
+    std::sort(values.begin(), values.end());
+    return values.at(std::max(0, int(ceil(fraction * values.size())) - 1));
+  }
+  void report()
+  {
+    std::cout << "input to sound latency, output latency " << audio::audioContext.value()["outputLatency"].as<double>() * 1000
+              << " ms, base latency " << audio::audioContext.value()["baseLatency"].as<double>() * 1000 << " ms\n";
+    for (auto& [name, latencies] : results) {
+      if (latencies.empty()) {
+        continue;
+      }
+      std::cout << name << ": " << latencies.size() << " probes, min " << percentile(latencies, 0)
+                << " ms, median " << percentile(latencies, 0.5) << " ms, p99 " << percentile(latencies, 0.99) << " ms\n";
+    }
+  }
+  void start(int count)
+  {
+    if (!audio::initialized || page != 11) {
+      std::cout << "Error: the latency probe needs the audio started and the piano page (7A) open\n";
+      return;
+    }
+    if (!analyser.has_value()) {
+      analyser.emplace(audio::audioContext.value().call<emscripten::val>("createAnalyser"));
+      analyser.value().set("fftSize", emscripten::val(2048));
+      analyserData.resize(2048);
+      // with -pthread the wasm memory is shared, which getFloatTimeDomainData refuses, so it fills a plain array first
+      analyserArray.emplace(emscripten::val::global("Float32Array").new_(2048));
+      // the very end of the graph, since engine voices never pass through the master bus
+      audio::outputBus.value().call<void>("connect", analyser.value());
+    }
+
+    results[backend()].clear();
+    remaining = count;
+    outstanding = false;
+    quietFrames = 0;
+  }
+  void poll()
+  {
+    // called every frame. the analyser holds the newest 2048 samples, so the first non-zero one can be placed
+    // exactly on the audio clock, and getOutputTimestamp maps that clock onto performance.now()
+    if (remaining == 0) {
+      return;
+    }
+    emscripten::val performance = emscripten::val::global("performance");
+    if (!outstanding) {
+      if (++quietFrames < framesBetweenProbes) {
+        return;
+      }
+      probeKey = (probeKey + 1) % pianoKeyCodes.size();
+      eventTime = performance.call<double>("now");
+      outstanding = true;
+      inject("keydown", probeKey, eventTime);
+      return;
+    }
+    analyser.value().call<void>("getFloatTimeDomainData", analyserArray.value());
+    emscripten::val(emscripten::typed_memory_view(analyserData.size(), analyserData.data())).call<void>("set", analyserArray.value());
+    emscripten::val timestamp = audio::audioContext.value().call<emscripten::val>("getOutputTimestamp");
+    double sampleRate = audio::audioContext.value()["sampleRate"].as<double>();
+    double bufferEnd = audio::now();
+    for (size_t i = 0; i < analyserData.size(); i++) {
+      if (analyserData[i] != 0) {
+        double sampleTime = bufferEnd - double(analyserData.size() - i) / sampleRate;
+        double heardAt = timestamp["performanceTime"].as<double>() + (sampleTime - timestamp["contextTime"].as<double>()) * 1000;
+        results[backend()].emplace_back(std::max(0.0, heardAt - eventTime));
+        outstanding = false;
+        break;
+      }
+    }
+    if (outstanding && performance.call<double>("now") - eventTime < timeout) {
+      return;
+    }
+    if (outstanding) {
+      std::cout << "latency probe timed out\n";
+      outstanding = false;
+    }
+    inject("keyup", probeKey, performance.call<double>("now"));
+    quietFrames = 0;
+    if (--remaining == 0) {
+      report();
+    }
+  }
+}
+
+void RunLatencyProbe(int count)
+{
+  latency::start(count);
+}
+
+namespace tolerance
+{
+  // Monte Carlo over the circuit from pages 2-7 built out of real parts: every sample draws L, C, R and the battery
+  // voltage uniformly from their tolerance bands and records the pitch, time constant and loudness that copy would make
+  struct tolerances
+  {
+    double inductance = 5, capacitance = 10, resistance = 1, voltage = 5; // ± percent
+  };
+  struct distribution
+  {
+    double low = 0, high = 0, mean = 0, deviation = 0;
+    std::vector<int> counts;
+  };
+  struct analysis
+  {
+    int samples = 0, overdamped = 0, threads = 1;
+    double milliseconds = 0;
+    distribution pitch, timeConstant, loudness;
+  };
+  const int defaultSamples = 100000;
+  const int binCount = 48;
+  std::optional<analysis> lastAnalysis;
+
+  using engine::thread_count;
+  using engine::parallel_for;
+  struct moments
+  {
+    double low = INFINITY, high = -INFINITY, sum = 0, sumOfSquares = 0;
+    int count = 0;
+    void add(double x)
+    {
+      low = std::min(low, x);
+      high = std::max(high, x);
+      sum += x;
+      sumOfSquares += x * x;
+      count++;
+    }
+    void merge(const moments& other)
+    {
+      low = std::min(low, other.low);
+      high = std::max(high, other.high);
+      sum += other.sum;
+      sumOfSquares += other.sumOfSquares;
+      count += other.count;
+    }
+  };
+  analysis run(double inductance, double capacitance, double resistance, double voltage, double efficiency, tolerances spread, int samples, unsigned seed)
+  {
+    // same units as the sidebar: H, nF, Ω, V and dB at 1 m. the loudness matches page 6 at 0.55 m
+    auto started = std::chrono::steady_clock::now();
+    analysis result;
+    result.samples = samples;
+    result.threads = std::min(thread_count(), std::max(1, samples / 1000));
+    std::vector<double> pitches(samples), timeConstants(samples), loudnesses(samples);
+    std::vector<moments> pitchMoments(result.threads), timeMoments(result.threads), loudnessMoments(result.threads);
+    double efficiencyWatts = audio::decibels_to_watts(efficiency, 1);
+    parallel_for(samples, result.threads, [&](long long begin, long long end, int thread) {
+      // every thread gets its own generator so nothing is shared but the output slices
+      std::seed_seq sequence{seed, unsigned(thread)};
+      std::mt19937_64 generator(sequence);
+      std::uniform_real_distribution<double> unit(-1, 1);
+      for (long long i = begin; i < end; i++) {
+        double l = inductance * (1 + spread.inductance / 100 * unit(generator));
+        double c = capacitance * (1 + spread.capacitance / 100 * unit(generator));
+        double r = resistance * (1 + spread.resistance / 100 * unit(generator));
+        double v = voltage * (1 + spread.voltage / 100 * unit(generator));
+        audio::rlc_response response = audio::solve_rlc(l, c / 1000000000, r, v);
+        // overdamped copies make no pitch at all, so they are left out of that histogram and counted instead
+        pitches[i] = response.regime == audio::damping::underdamped ? response.omega / (2*pi) : NAN;
+        timeConstants[i] = 2 * l / r;
+        loudnesses[i] = audio::watts_to_decibels(efficiencyWatts * 0.5 * c * v * v / l / 1000000, 0.55);
+        if (!std::isnan(pitches[i])) {
+          pitchMoments[thread].add(pitches[i]);
+        }
+        timeMoments[thread].add(timeConstants[i]);
+        loudnessMoments[thread].add(loudnesses[i]);
+      }
+    });
+    for (int t = 1; t < result.threads; t++) {
+      pitchMoments[0].merge(pitchMoments[t]);
+      timeMoments[0].merge(timeMoments[t]);
+      loudnessMoments[0].merge(loudnessMoments[t]);
+    }
+    result.overdamped = samples - pitchMoments[0].count;
+    std::array<distribution*, 3> outputs = {&result.pitch, &result.timeConstant, &result.loudness};
+    std::array<const moments*, 3> totals = {&pitchMoments[0], &timeMoments[0], &loudnessMoments[0]};
+    std::array<const std::vector<double>*, 3> values = {&pitches, &timeConstants, &loudnesses};
+    for (int k = 0; k < 3; k++) {
+      distribution& d = *outputs[k];
+      const moments& m = *totals[k];
+      d.counts.assign(binCount, 0);
+      if (m.count == 0) {
+        continue;
+      }
+      d.low = m.low;
+      d.high = m.high;
+      d.mean = m.sum / m.count;
+      d.deviation = sqrt(std::max(0.0, m.sumOfSquares / m.count - d.mean * d.mean));
+    }
+    // the bin edges need the global range, so binning is a second parallel pass with per-thread counts
+    std::vector<std::array<std::vector<int>, 3>> binned(result.threads);
+    parallel_for(samples, result.threads, [&](long long begin, long long end, int thread) {
+      for (int k = 0; k < 3; k++) {
+        const distribution& d = *outputs[k];
+        const std::vector<double>& x = *values[k];
+        std::vector<int>& counts = binned[thread][k];
+        counts.assign(binCount, 0);
+        double width = d.high - d.low;
+        double scale = width > 0 ? binCount / width : 0;
+        for (long long i = begin; i < end; i++) {
+          if (!std::isnan(x[i])) {
+            counts[std::min(binCount - 1, int((x[i] - d.low) * scale))]++;
+          }
+        }
+      }
+    });
+    for (int t = 0; t < result.threads; t++) {
+      for (int k = 0; k < 3; k++) {
+        for (int b = 0; b < binCount; b++) {
+          outputs[k]->counts[b] += binned[t][k][b];
+        }
+      }
+    }
+    result.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+    return result;
+  }
+}
+
+namespace spectrogram
+{
+  // a scrolling spectrogram of the output. every hop of new samples is one FFT and one new column of pixels, the older
+  // columns are never computed again: the canvas shifts what it already shows left and only the new columns are drawn.
+  // while the engine node is patched in anyway its output ring has every sample. otherwise patching it in just for this
+  // would put a buffer of latency on everything, so the samples come from an analyser on the output bus instead
+  const size_t fftSize = 2048; // 23 Hz per bin at 48 kHz
+  const size_t hop = 512; // about 94 columns a second
+  const int width = 300, height = 160;
+  const double topFrequency = 5000; // linear up to here, so harmonics are evenly spaced
+  const double floorDecibels = -90;
+  const int maxColumns = 32; // per frame, anything more was waiting too long to be worth showing
+  bool shown = false;
+  std::vector<double> samples(fftSize + hop * maxColumns);
+  size_t filled = 0;
+  std::vector<engine::complex> spectrum(fftSize);
+  std::vector<double> window;
+  std::vector<int> rowBins; // row r shows the loudest of bins [rowBins[r + 1], rowBins[r]), row 0 at the top
+  std::array<std::array<uint8_t, 3>, 256> palette;
+  std::vector<uint8_t> pixels(4 * maxColumns * height); // RGBA, maxColumns wide
+  std::optional<emscripten::val> image;
+  // the analyser keeps the newest analyserSize samples, a dozen hops past the first window, which covers a slow frame
+  const size_t analyserSize = 8192;
+  std::optional<emscripten::val> analyser, analyserData;
+  std::vector<float> recent(analyserSize);
+  long long nextColumn = -1; // on the context's sample clock, where the window of the next analyser column ends
+  void prepare()
+  {
+    window.resize(fftSize);
+    for (size_t i = 0; i < fftSize; i++) {
+      window[i] = 0.5 - 0.5 * cos(2*pi*i / fftSize);
+    }
+    rowBins.resize(height + 1);
+    for (int row = 0; row <= height; row++) {
+      rowBins[row] = std::clamp<int>(lround(topFrequency * (height - row) / height * fftSize / engine::sampleRate), 1, fftSize / 2);
+    }
+    // black through red and yellow to white
+    for (int i = 0; i < 256; i++) {
+      double t = i / 255.0;
+      palette[i] = {uint8_t(255 * std::clamp(3 * t, 0.0, 1.0)), uint8_t(255 * std::clamp(3 * t - 1, 0.0, 1.0)), uint8_t(255 * std::clamp(3 * t - 2, 0.0, 1.0))};
+    }
+  }
+  void show(bool visible)
+  {
+    // the rows are laid out again in case the sample rate changed, and whatever was left from last time is dropped.
+    // the engine copies its output out the whole time this is up, which costs nothing while it is not patched in
+    if (visible) {
+      prepare();
+    }
+    shown = visible;
+    filled = 0;
+    nextColumn = -1;
+    while (engine::pop_many(engine::output, std::span<double>(samples)) > 0) {
+    }
+    engine::tapOutput = visible;
+  }
+  void column(std::span<const double> frame, int x)
+  {
+    for (size_t i = 0; i < fftSize; i++) {
+      spectrum[i] = frame[i] * window[i];
+    }
+    engine::fft(spectrum, false);
+    for (int row = 0; row < height; row++) {
+      double loudest = 0;
+      for (int bin = rowBins[row + 1]; bin < std::max(rowBins[row], rowBins[row + 1] + 1); bin++) {
+        loudest = std::max(loudest, std::norm(spectrum[bin]));
+      }
+      // a sine of amplitude a peaks at a * fftSize / 4 through a Hann window
+      double decibels = 10 * log10(std::max(loudest, 1e-30)) + 20 * log10(4.0 / fftSize);
+      int level = std::clamp<int>(lround(255 * (1 - decibels / floorDecibels)), 0, 255);
+      uint8_t* pixel = &pixels[4 * (row * maxColumns + x)];
+      pixel[0] = palette[level][0];
+      pixel[1] = palette[level][1];
+      pixel[2] = palette[level][2];
+      pixel[3] = 255;
+    }
+  }
+  void update()
+  {
+    if (!shown) {
+      return;
+    }
+    emscripten::val canvas = document.call<emscripten::val>("getElementById", emscripten::val("spectrogram"));
+    if (canvas.isNull()) {
+      return;
+    }
+    int count = 0;
+    if (audio::engineConnected) {
+      nextColumn = -1;
+      for (;;) {
+        filled += engine::pop_many(engine::output, std::span<double>(samples).subspan(filled));
+        if (filled < fftSize || count == maxColumns) {
+          break;
+        }
+        column(std::span<const double>(samples).first(fftSize), count++);
+        std::copy(samples.begin() + hop, samples.begin() + filled, samples.begin());
+        filled -= hop;
+      }
+    } else if (audio::initialized) {
+      if (!analyser) {
+        analyser.emplace(audio::audioContext.value().call<emscripten::val>("createAnalyser"));
+        analyser.value().set("fftSize", emscripten::val(analyserSize));
+        analyserData.emplace(emscripten::val::global("Float32Array").new_(analyserSize));
+        audio::outputBus.value().call<void>("connect", analyser.value());
+      }
+      // a plain array for the same reason as the latency probe's. the analyser's newest sample is at the context's
+      // current time. a column whose window has already slid out of it is skipped, the same as when there were more
+      // than maxColumns waiting
+      analyser.value().call<void>("getFloatTimeDomainData", analyserData.value());
+      emscripten::val(emscripten::typed_memory_view(recent.size(), recent.data())).call<void>("set", analyserData.value());
+      long long newest = llround(audio::now() * engine::sampleRate);
+      if (nextColumn < 0) {
+        nextColumn = newest;
+      }
+      nextColumn = std::max(nextColumn, newest - (long long) (analyserSize - fftSize));
+      for (; nextColumn <= newest && count < maxColumns; nextColumn += hop) {
+        size_t end = analyserSize - (newest - nextColumn);
+        std::copy(recent.begin() + (end - fftSize), recent.begin() + end, samples.begin());
+        column(std::span<const double>(samples).first(fftSize), count++);
+      }
+    }
+    // whatever is still waiting is too old to be worth drawing, and the ring is not read at all while the analyser is
+    if (count == maxColumns || !audio::engineConnected) {
+      filled = 0;
+      while (engine::pop_many(engine::output, std::span<double>(samples)) > 0) {
+      }
+    }
+
+    if (count == 0) {
+      return;
+    }
+    emscripten::val ctx = canvas.call<emscripten::val>("getContext", emscripten::val("2d"));
+    if (!image) {
+      image.emplace(ctx.call<emscripten::val>("createImageData", emscripten::val(maxColumns), emscripten::val(height)));
+    }
+    image.value()["data"].call<void>("set", emscripten::val(emscripten::typed_memory_view(pixels.size(), pixels.data())));
+    ctx.call<void>("drawImage", canvas, emscripten::val(-count), emscripten::val(0));
+    ctx.call<void>("putImageData", image.value(), emscripten::val(width - count), emscripten::val(0),
+                   emscripten::val(0), emscripten::val(0), emscripten::val(count), emscripten::val(height));
+  }
+}
+
+void RunToleranceAnalysis(emscripten::val event)
+{
+  emscripten::val report = document.call<emscripten::val>("getElementById", emscripten::val("toleranceReport"));
+  if (inductance <= 0 || capacitance <= 0 || resistance <= 0 || volts <= 0) {
+    report.set("innerHTML", emscripten::val("Please finish the circuit on the previous pages first."));
+    return;
+  }
+  tolerance::tolerances spread;
+  std::array<std::pair<const char*, double*>, 4> fields = {{{"tolLValue", &spread.inductance}, {"tolValue", &spread.capacitance},
+                                                             {"tolRValue", &spread.resistance}, {"tolVValue", &spread.voltage}}};
+  for (auto [id, percent] : fields) {
+    std::string value = document.call<emscripten::val>("getElementById", emscripten::val(id))["value"].as<std::string>();
+    if (value != "") {
+      *percent = stod(value);
+    }
+  }
+  tolerance::lastAnalysis = tolerance::run(inductance, capacitance, resistance, volts, efficiency, spread, tolerance::defaultSamples, std::random_device{}());
+  const tolerance::analysis& a = tolerance::lastAnalysis.value();
+  std::ostringstream text;
+  text << std::fixed << std::setprecision(1);
+  text << a.samples << " circuits in " << a.milliseconds << " ms on " << a.threads << (a.threads == 1 ? " thread" : " threads") << "<br>";
+  text << "f = " << a.pitch.mean << " ± " << a.pitch.deviation << " Hz<br>";
+  text << std::setprecision(4) << "τ = " << a.timeConstant.mean << " ± " << a.timeConstant.deviation << " s<br>";
+  text << std::setprecision(1) << "SPL = " << a.loudness.mean << " ± " << a.loudness.deviation << " dB";
+  if (a.overdamped > 0) {
+    text << "<br>" << a.overdamped << " of them were overdamped and made no sound";
+  }
+  report.set("innerHTML", emscripten::val(text.str()));
 }
 
 void PlayOrPauseSound(emscripten::val event)
 {
+  session::record('P', "");
   audio::play_or_stop_everything();
   emscripten::val play = document.call<emscripten::val>("getElementById", emscripten::val("play"));
   if(audio::get_playing()) {
@@ -394,6 +1853,25 @@ void PlayOrPauseSound(emscripten::val event)
   }
 }
 
+void ProcessAudio(emscripten::val event)
+{
+  // ScriptProcessorNode callback: copy the mix into wasm, run the engine on it and copy it back out
+  static std::vector<float> samples;
+  static std::vector<double> block;
+  emscripten::val input = event["inputBuffer"].call<emscripten::val>("getChannelData", 0);
+  emscripten::val output = event["outputBuffer"].call<emscripten::val>("getChannelData", 0);
+  size_t length = input["length"].as<size_t>();
+  // playbackTime is when this buffer will be heard, which keeps the engine clock on the context clock even if a callback is dropped
+  engine::live.currentSample = llround(event["playbackTime"].as<double>() * engine::sampleRate);
+  samples.resize(length);
+  block.resize(length);
+  emscripten::val(emscripten::typed_memory_view(length, samples.data())).call<void>("set", input);
+  std::copy(samples.begin(), samples.end(), block.begin());
+  engine::process(block);
+  std::copy(block.begin(), block.end(), samples.begin());
+  output.call<void>("set", emscripten::val(emscripten::typed_memory_view(length, samples.data())));
+}
+
 void InteractWithCanvas(emscripten::val event)
 {
   // std::string eventName = event["type"].as<std::string>();
@@ -408,95 +1886,26 @@ void InteractWithKeyboard(emscripten::val event)
     case(11):
     {
       std::string eventName = event["type"].as<std::string>();
-      if(eventName == "keydown") {
-        switch(event["keyCode"].as<int>()) {
-          case 90:
-            pianoKeys.at(0) = true;
-            break;
-          case 83:
-            pianoKeys.at(1) = true;
-            break;
-          case 88:
-            pianoKeys.at(2) = true;
-            break;
-          case 68:
-            pianoKeys.at(3) = true;
-            break;
-          case 67:
-            pianoKeys.at(4) = true;
-            break;
-          case 86:
-            pianoKeys.at(5) = true;
-            break;
-          case 71:
-            pianoKeys.at(6) = true;
-            break;
-          case 66:
-            pianoKeys.at(7) = true;
-            break;
-          case 72:
-            pianoKeys.at(8) = true;
-            break;
-          case 78:
-            pianoKeys.at(9) = true;
-            break;
-          case 74:
-            pianoKeys.at(10) = true;
-            break;
-          case 77:
-            pianoKeys.at(11) = true;
-            break;
-          case 188:
-            pianoKeys.at(12) = true;
-            break;
-          default:
-            break;
-        }
-      } else if (eventName == "keyup") {
-        switch(event["keyCode"].as<int>()) {
-          case 90:
-            pianoKeys.at(0) = false;
-            break;
-          case 83:
-            pianoKeys.at(1) = false;
-            break;
-          case 88:
-            pianoKeys.at(2) = false;
-            break;
-          case 68:
-            pianoKeys.at(3) = false;
-            break;
-          case 67:
-            pianoKeys.at(4) = false;
-            break;
-          case 86:
-            pianoKeys.at(5) = false;
-            break;
-          case 71:
-            pianoKeys.at(6) = false;
-            break;
-          case 66:
-            pianoKeys.at(7) = false;
-            break;
-          case 72:
-            pianoKeys.at(8) = false;
-            break;
-          case 78:
-            pianoKeys.at(9) = false;
-            break;
-          case 74:
-            pianoKeys.at(10) = false;
-            break;
-          case 77:
-            pianoKeys.at(11) = false;
-            break;
-          case 188:
-            pianoKeys.at(12) = false;
-            break;
-          default:
-            break;
-        }
+      int keyCode = event["keyCode"].as<int>();
+      int key = keyCode >= 0 && keyCode < int(pianoKeyMap.size()) ? pianoKeyMap[keyCode] : -1;
+      // holding a key down fires repeated keydowns, which should not retrigger the note
+      if (key == -1 || (eventName == "keydown" && event["repeat"].as<bool>())) {
+        break;
+      }
+      bool on = eventName == "keydown";
+      if (!on && eventName != "keyup") {
+        break;
       }
+      session::record('k', std::string(on ? "d " : "u ") + std::to_string(keyCode));
+      pianoKeys.at(key) = on;
+      // the arpeggiator plays whatever is held, and while it runs the keys only sound on its steps
+      audio::hold_keys(pianoKeys);
+      if (on && audio::arpeggiating()) {
+        break;
+      }
+      std::string waveform = document.call<emscripten::val>("getElementById", emscripten::val("wave"))["value"].as<std::string>();
+      int partials = waveform == "saw" ? 10 : 1;
+      audio::play_key(key, partials, on, event["timeStamp"].as<double>());
       break;
     }
     default:
@@ -676,6 +2085,96 @@ void DrawCurrent(emscripten::val ctx, double x, double y, double spacing, double
     ctx.set("lineWidth", emscripten::val(1));
   }
 }
+void DrawScope(emscripten::val ctx, double x, double y, double w, double h, double span)
+{
+  // draws the last span seconds of the real circuit current as one path, scaled so the loudest possible peak fits in h
+  static std::vector<double> samples(256);
+  double time = audio::now();
+  double dt = span / (samples.size() - 1);
+  audio::sample_current(time - span, dt, samples);
+  double peak = audio::get_peak_current(time - span);
+  double scale = peak > 0 ? h / (2 * peak) : 0;
+  ctx.call<void>("strokeRect", x, y, w, h);
+  ctx.call<void>("beginPath");
+  ctx.call<void>("moveTo", x, y + h/2 - scale * samples[0]);
+  for (size_t i = 1; i < samples.size(); i++) {
+    ctx.call<void>("lineTo", x + w * i / (samples.size() - 1), y + h/2 - scale * samples[i]);
+  }
+  ctx.call<void>("stroke");
+}
+void DrawHistogram(emscripten::val ctx, double x, double y, double w, double h, const tolerance::distribution& d, std::string label)
+{
+  // bars as one path, scaled so the tallest bin fills h, with the label and range underneath
+  int tallest = *std::max_element(d.counts.begin(), d.counts.end());
+  ctx.call<void>("strokeRect", x, y, w, h);
+  if (tallest > 0) {
+    double barWidth = w / d.counts.size();
+    ctx.call<void>("beginPath");
+    for (size_t i = 0; i < d.counts.size(); i++) {
+      double barHeight = h * d.counts[i] / tallest;
+      ctx.call<void>("rect", x + i * barWidth, y + h - barHeight, barWidth, barHeight);
+    }
+    ctx.call<void>("fill");
+  }
+  // drawn every frame, so the range is formatted on the stack rather than through a stream
+  char range[64];
+  snprintf(range, sizeof(range), "%.4g – %.4g", d.low, d.high);
+  ctx.call<void>("fillText", emscripten::val(label), x + w/2, y + h + 15);
+  ctx.call<void>("fillText", emscripten::val(range), x + w/2, y + h + 35);
+}
+void DrawBode(emscripten::val ctx, double x, double y, double w, double h)
+{
+  // magnitude (0 to -60 dB, solid) and phase (+90° to -90°, dashed) of the circuit current from 20 Hz to 20 kHz.
+  // the response is only evaluated again when L, C or R change, and each curve is kept as one Path2D that is only
+  // rebuilt when the response or the box changes, so a frame costs two strokes
+  if (inductance <= 0 || capacitance <= 0 || resistance <= 0) {
+    return;
+  }
+  const int points = 2048;
+  const double lowest = 20, highest = 20000, floorDecibels = -60;
+  static std::vector<double> frequencies, decibels(points), degrees(points);
+  if (frequencies.empty()) {
+    for (int i = 0; i < points; i++) {
+      frequencies.push_back(lowest * pow(highest / lowest, double(i) / (points - 1)));
+    }
+  }
+  static std::array<double, 3> previousCircuit = {-1, -1, -1};
+  static std::array<double, 4> previousBox;
+  static std::optional<emscripten::val> magnitudePath, phasePath;
+  static const emscripten::val dashed = emscripten::val::array(std::vector<double>{6, 4});
+  static const emscripten::val solid = emscripten::val::array();
+  std::array<double, 3> circuit = {inductance, capacitance, resistance};
+  std::array<double, 4> box = {x, y, w, h};
+  if (circuit != previousCircuit || box != previousBox) {
+    if (circuit != previousCircuit) {
+      audio::series_response(inductance, capacitance / 1000000000, resistance, frequencies, decibels, degrees);
+    }
+    // as SVG path data, so the whole curve crosses into js in one call
+    auto path = [&](std::span<const double> values, double top, double bottom) {
+      std::string d;
+      d.reserve(points * 20);
+      char point[32];
+      for (int i = 0; i < points; i++) {
+        double fraction = std::clamp((top - values[i]) / (top - bottom), 0.0, 1.0);
+        snprintf(point, sizeof(point), "%c%.1f %.1f", i == 0 ? 'M' : 'L', x + w * i / (points - 1), y + h * fraction);
+        d += point;
+      }
+      return emscripten::val::global("Path2D").new_(emscripten::val(d));
+    };
+    magnitudePath.emplace(path(decibels, 0, floorDecibels));
+    phasePath.emplace(path(degrees, 90, -90));
+    previousCircuit = circuit;
+    previousBox = box;
+  }
+  ctx.call<void>("strokeRect", x, y, w, h);
+  ctx.call<void>("stroke", magnitudePath.value());
+  ctx.call<void>("setLineDash", dashed);
+  ctx.call<void>("stroke", phasePath.value());
+  ctx.call<void>("setLineDash", solid);
+  ctx.call<void>("fillText", emscripten::val("20 Hz"), x, y + h + 15);
+  ctx.call<void>("fillText", emscripten::val("CURRENT (dB) AND PHASE (dashed)"), x + w/2, y + h + 15);
+  ctx.call<void>("fillText", emscripten::val("20 kHz"), x + w, y + h + 15);
+}
 void DrawExampleCircuit(emscripten::val ctx, bool highlightCapacitor, bool highlightInductor, bool highlightResistor, bool highlightBattery) {
   double width = ctx["canvas"]["width"].as<double>();
   double height = ctx["canvas"]["height"].as<double>();
@@ -994,9 +2493,7 @@ void RenderCanvas()
   emscripten::val ctx = canvas.call<emscripten::val>("getContext", emscripten::val("2d"));
 
   // subtly change the fillStyle color
-  const static std::string hex[16] = {"0","1","2","3","4","5","6","7","8","9","A","B","C","D","E","F"};
-  std::random_device rd;
-  std::default_random_engine gen(rd());
+  static std::default_random_engine gen(std::random_device{}());
   std::uniform_int_distribution<int> colorDist(200,255);
   std::uniform_int_distribution<int> widthDist(0,canvas["width"].as<int>());
   std::uniform_int_distribution<int> heightDist(0,canvas["height"].as<int>());
@@ -1009,31 +2506,23 @@ void RenderCanvas()
                              widthDist(gen), heightDist(gen)});
   }
   if (FRAME_COUNT % 300 == 0) {
-    interpolation.erase(interpolation.begin());
-    interpolation.push_back({colorDist(gen), colorDist(gen), colorDist(gen), colorDist(gen), colorDist(gen), colorDist(gen), widthDist(gen), heightDist(gen),
-                                       widthDist(gen), heightDist(gen)});
+    // the old end point becomes the start and is overwritten in place, so no new rows are allocated
+    std::swap(interpolation[0], interpolation[1]);
+    interpolation[1] = {colorDist(gen), colorDist(gen), colorDist(gen), colorDist(gen), colorDist(gen), colorDist(gen), widthDist(gen), heightDist(gen),
+                        widthDist(gen), heightDist(gen)};
   }
   emscripten::val gradient = ctx.call<emscripten::val>("createLinearGradient",
                                                        emscripten::val(interpolate_split(interpolation,6,FRAME_COUNT,canvas["width"].as<int>())),
                                                        emscripten::val(interpolate_split(interpolation,7,FRAME_COUNT,canvas["height"].as<int>())),
                                                        emscripten::val(interpolate_split(interpolation,8,FRAME_COUNT,canvas["width"].as<int>())),
                                                        emscripten::val(interpolate_split(interpolation,9,FRAME_COUNT,canvas["height"].as<int>())));
-  std::string temp = "";
-  int tens = 256*256*interpolate(interpolation,0,FRAME_COUNT)+256*interpolate(interpolation,1,FRAME_COUNT)+interpolate(interpolation,2,FRAME_COUNT);
-  while (tens != 0)
-  {
-    temp = hex[tens%16] + temp;
-    tens = floor(tens/16);
-  }
-  gradient.call<void>("addColorStop", emscripten::val(0), emscripten::val("#" + temp));
-  temp = "";
-  tens = 256*256*interpolate(interpolation,3,FRAME_COUNT)+256*interpolate(interpolation,4,FRAME_COUNT)+interpolate(interpolation,5,FRAME_COUNT);
-  while (tens != 0)
-  {
-    temp = hex[tens%16] + temp;
-    tens = floor(tens/16);
-  }
-  gradient.call<void>("addColorStop", emscripten::val(1), emscripten::val("#" + temp));
+  char color[8];
+  snprintf(color, sizeof(color), "#%02X%02X%02X", interpolate(interpolation,0,FRAME_COUNT), interpolate(interpolation,1,FRAME_COUNT),
+           interpolate(interpolation,2,FRAME_COUNT));
+  gradient.call<void>("addColorStop", emscripten::val(0), emscripten::val(color));
+  snprintf(color, sizeof(color), "#%02X%02X%02X", interpolate(interpolation,3,FRAME_COUNT), interpolate(interpolation,4,FRAME_COUNT),
+           interpolate(interpolation,5,FRAME_COUNT));
+  gradient.call<void>("addColorStop", emscripten::val(1), emscripten::val(color));
   ctx.set("fillStyle", gradient);
   ctx.call<void>("fillRect", 0, 0, canvas["width"], canvas["height"]);
   ctx.set("fillStyle", emscripten::val("black"));
@@ -1074,12 +2563,15 @@ void RenderCanvas()
       break;
     case 2:
       DrawFullCircuit(ctx, false, true, true, false);
+      DrawBode(ctx, width * 0.1, height * 0.65, width * 0.8, height * 0.25);
       break;
     case 3:
       DrawFullCircuit(ctx, true, true, false, false);
+      DrawBode(ctx, width * 0.1, height * 0.65, width * 0.8, height * 0.25);
       break;
     case 4:
       DrawFullCircuit(ctx, true, true, false, false);
+      DrawBode(ctx, width * 0.1, height * 0.65, width * 0.8, height * 0.25);
       break;
     case 5: {
       // these are in pixels
@@ -1159,15 +2651,25 @@ void RenderCanvas()
     }
     case 6:
       DrawFullCircuit(ctx, false, false, false, true);
+      DrawBode(ctx, width * 0.1, height * 0.65, width * 0.8, height * 0.25);
       break;
     case 7: {
       DrawCurrent(ctx, width * 0.5, height * 0.2, 10, width * 0.1 * audio::get_slowed_current(), "(SLOWED 100x)", false);
       DrawCurrent(ctx, width * 0.7, height * 0.2, 10, width * 0.1 * audio::get_current(), "(REAL TIME)", false);
       DrawFullCircuit(ctx, false, false, true, false);
+      DrawScope(ctx, width * 0.1, height * 0.65, width * 0.38, height * 0.25, 0.01);
+      DrawBode(ctx, width * 0.52, height * 0.65, width * 0.38, height * 0.25);
+      if (tolerance::lastAnalysis) {
+        const tolerance::analysis& a = tolerance::lastAnalysis.value();
+        DrawHistogram(ctx, width * 0.1, height * 0.02, width * 0.24, height * 0.06, a.pitch, "PITCH (Hz)");
+        DrawHistogram(ctx, width * 0.38, height * 0.02, width * 0.24, height * 0.06, a.timeConstant, "τ (s)");
+        DrawHistogram(ctx, width * 0.66, height * 0.02, width * 0.24, height * 0.06, a.loudness, "SPL (dB)");
+      }
       break;
     }
     case 8: {
       DrawFullCircuit(ctx, true, false, false, false);
+      DrawScope(ctx, width * 0.1, height * 0.65, width * 0.8, height * 0.25, 0.01);
       break;
     }
     case 9:
@@ -1178,12 +2680,12 @@ void RenderCanvas()
       break;
     case 11:
     {
-      std::string keys[13] = {"Z", "X", "C", "V", "B", "N", "M", ",", "S", "D", "G", "H", "J"};
+      const char* keys[13] = {"Z", "X", "C", "V", "B", "N", "M", ",", "S", "D", "G", "H", "J"};
       for(int i = 0; i < 8; i++) {
         ctx.call<void>("beginPath");
         ctx.call<void>("rect", width*(0.1 + 0.1*i), height*0.25, width*(0.1), height*0.5);
         ctx.call<void>("stroke");
-        ctx.call<void>("fillText", keys[i], width*(0.15+0.1*i), height*0.7);
+        ctx.call<void>("fillText", emscripten::val(keys[i]), width*(0.15+0.1*i), height*0.7);
       }
       for(int i = 0; i < 2; i++) {
         ctx.set("fillStyle", emscripten::val("black"));
@@ -1191,7 +2693,7 @@ void RenderCanvas()
         ctx.call<void>("rect", width*(0.17 + 0.1*i), height*0.25, width*(0.06), height*0.3);
         ctx.call<void>("fill");
         ctx.set("fillStyle", emscripten::val("white"));
-        ctx.call<void>("fillText", keys[i+8], width*(0.2+0.1*i), height*0.5);
+        ctx.call<void>("fillText", emscripten::val(keys[i+8]), width*(0.2+0.1*i), height*0.5);
       }
       for(int i = 0; i < 3; i++) {
         ctx.set("fillStyle", emscripten::val("black"));
@@ -1199,8 +2701,10 @@ void RenderCanvas()
         ctx.call<void>("rect", width*(0.47 + 0.1*i), height*0.25, width*(0.06), height*0.3);
         ctx.call<void>("fill");
         ctx.set("fillStyle", emscripten::val("white"));
-        ctx.call<void>("fillText", keys[i+10], width*(0.5+0.1*i), height*0.5);
+        ctx.call<void>("fillText", emscripten::val(keys[i+10]), width*(0.5+0.1*i), height*0.5);
       }
+      ctx.set("fillStyle", emscripten::val("black"));
+      DrawScope(ctx, width * 0.1, height * 0.8, width * 0.8, height * 0.15, 0.01);
       break;
     }
     default:
@@ -1347,6 +2851,16 @@ void addCapacitorLabelSet(emscripten::val info, emscripten::val cValue, std::str
   addLabel(info, c, "nF");
 }
 
+void addSpectrogram(emscripten::val info) {
+  addParagraph(info, "What you hear, from 0 at the bottom to 5 kHz at the top, newest on the right:");
+  emscripten::val canvas = document.call<emscripten::val>("createElement", emscripten::val("canvas"));
+  canvas.set("id", "spectrogram");
+  canvas.set("width", spectrogram::width);
+  canvas.set("height", spectrogram::height);
+  canvas.call<emscripten::val>("getContext", emscripten::val("2d")).call<void>("fillRect", 0, 0, spectrogram::width, spectrogram::height);
+  info.call<void>("appendChild", canvas);
+}
+
 void addSelectOctave(emscripten::val info, std::string id) {
   emscripten::val sel = document.call<emscripten::val>("createElement", emscripten::val("select"));
   sel.set("id", id);
@@ -1406,29 +2920,135 @@ void addSelectOctave(emscripten::val info, std::string id) {
   sel.call<void>("appendChild", c2);
 }
 
-void InitializePage(int i)
+bool SendKeyboard()
+{
+  // the sequencer's copy of the keys, at the current sample rate. culling is counted when a key is played, not here.
+  // false when the engine could not take it and still has the old keys
+  auto keys = std::make_unique<engine::keyboard>();
+  engine::cull_counters counters;
+  for (auto& partials : pianouuids) {
+    std::vector<engine::voice>& voices = keys->emplace_back();
+    for (auto& uuid : partials) {
+      std::optional<engine::voice> v = engine::make_voice(0, audio::get_frequencies().at(uuid), audio::get_initial_volumes().at(uuid),
+                                                          audio::get_time_constants().at(uuid), 0, counters);
+      if (v) {
+        voices.push_back(v.value());
+      }
+    }
+  }
+  if (!audio::send({.type = engine::command::kind::set_keyboard, .keys = keys.get()})) {
+    return false;
+  }
+  keys.release();
+  return true;
+}
+
+void BuildPianoVoices(int baseKey)
+{
+  // every key gets its 10 harmonics from the tuning table, the sine wave only uses the first
+  pianoKeys.assign(13, false);
+  pianouuids.clear();
+  audio::remove_all_rlcs();
+  audio::rlc_map defaults;
+  for (int i = 0; i < 13; i++) {
+    std::vector<boost::uuids::uuid> s1;
+    for (int j = 1; j < 11; j++) {
+      boost::uuids::uuid uuid = uuidGenerator();
+      defaults.try_emplace(uuid, std::make_tuple((*keyboardTuning)[baseKey + i] * j, initialVolume / double(j), timeConstant));
+      s1.emplace_back(uuid);
+    }
+    pianouuids.emplace_back(s1);
+  }
+  audio::add_rlcs(defaults);
+  audio::keyboardVoices = pianouuids;
+  SendKeyboard();
+}
+
+void LoadScala(emscripten::val text)
+{
+  std::optional<tuning::table> table = tuning::scala(text.as<std::string>());
+  if (table.has_value()) {
+    scalaTuning = table.value();
+    document.call<emscripten::val>("getElementById", emscripten::val("tuning")).set("value", emscripten::val("scala"));
+  } else {
+    std::cout << "Error: could not read the Scala file\n";
+  }
+}
+
+void LoadScalaFile(emscripten::val event)
+{
+  emscripten::val files = event["target"]["files"];
+  if (files["length"].as<int>() > 0) {
+    files[0].call<emscripten::val>("text").call<void>("then", emscripten::val::module_property("LoadScala"));
+  }
+}
+void LoadRoom(emscripten::val buffer)
+{
+  std::vector<uint8_t> bytes = emscripten::convertJSArrayToNumberVector<uint8_t>(emscripten::val::global("Uint8Array").new_(buffer));
+  std::optional<engine::wav> file = engine::parse_wav(bytes);
+  if (file.has_value()) {
+    engine::roomFile = file;
+    roomFileLoads++;
+    document.call<emscripten::val>("getElementById", emscripten::val("room")).set("value", emscripten::val("file"));
+  } else {
+    std::cout << "Error: could not read the WAV file\n";
+  }
+}
+void LoadRoomFile(emscripten::val event)
+{
+  emscripten::val files = event["target"]["files"];
+  if (files["length"].as<int>() > 0) {
+    files[0].call<emscripten::val>("arrayBuffer").call<void>("then", emscripten::val::module_property("LoadRoom"));
+  }
+}
+
+void StoreData(int page); // forward declaration
+
+void LoadSample(emscripten::val buffer)
+{
+  std::vector<uint8_t> bytes = emscripten::convertJSArrayToNumberVector<uint8_t>(emscripten::val::global("Uint8Array").new_(buffer));
+  std::optional<engine::wav> file = engine::parse_wav(bytes);
+  emscripten::val report = document.call<emscripten::val>("getElementById", emscripten::val("resynthesis"));
+  if (!file.has_value()) {
+    std::cout << "Error: could not read the WAV file\n";
+    report.set("innerHTML", emscripten::val("That is not a WAV file this can read."));
+    return;
+  }
+  resynthesis::result r = resynthesis::analyze(file->samples, file->sampleRate);
+  if (audio::get_playing()) {
+    PlayOrPauseSound(emscripten::val(""));
+  }
+  audio::remove_all_rlcs();
+  audio::rlc_map circuits;
+  for (auto& rlc : r.rlcs) {
+    circuits.try_emplace(uuidGenerator(), rlc);
+  }
+  audio::add_rlcs(circuits);
+  StoreData(page);
+  std::ostringstream text;
+  text << std::fixed << std::setprecision(1);
+  text << r.partials << " partials in " << r.seconds << " s of sound, the strongest " << r.rlcs.size() << " are now RLC circuits. "
+       << "Analyzed in " << r.milliseconds << " ms on " << r.threads << (r.threads == 1 ? " thread." : " threads.");
+  report.set("innerHTML", emscripten::val(text.str()));
+}
+void LoadSampleFile(emscripten::val event)
+{
+  emscripten::val files = event["target"]["files"];
+  if (files["length"].as<int>() > 0) {
+    files[0].call<emscripten::val>("arrayBuffer").call<void>("then", emscripten::val::module_property("LoadSample"));
+  }
+}
+
+void BuildPage(int i, emscripten::val info)
 {
-  emscripten::val info = document.call<emscripten::val>("getElementById", emscripten::val("info"));
-  info.set("innerHTML", "");
+  // only the page's elements, everything that depends on state is set by EnterPage on every visit
   switch(i) {
     case (0):
-      if (circuitCompleted) {
-        enablePlayButton();
-      } else {
-        disablePlayButton();
-      }
-      enableNextButton();
       addBigParagraph(info, "Welcome to AnaSynth!");
       addParagraph(info, "Shown to the left is the classic LC circuit composed of an inductor (L) and a capacitor (C), oscillating 440 times per second (slowed down 1000x for visualization). These oscillations will go on forever, as long as there is 0 resistance in the circuit.");
       addParagraph(info, "But what if we add a resistor (R) to the circuit, turning the LC circuit into an RLC circuit? The current in RC and RL circuits decrease exponentially as time goes on. But would an RLC circuit also decrease exponentially?");
       break;
     case (1):
-      if (circuitCompleted) {
-        enablePlayButton();
-      } else {
-        disablePlayButton();
-      }
-      enableNextButton();
       addParagraph(info, "It turns out that the addition of a resistor does indeed decrease the maximum current exponentially, and the current still oscillates!");
       addParagraph(info, "As a reminder, the time constant of a circuit is the amount of time for the maximum current to decrease by a factor of e.");
       addParagraph(info,
@@ -1442,18 +3062,6 @@ void InitializePage(int i)
       emscripten::val lValue = addInputField("lValue", false, 0.1, 0);
       emscripten::val rValue = addInputField("rValue", true, 0.1, 0);
       emscripten::val tValue = addInputField("tValue", true, 0.1, 0);
-      if (inductance != -1)
-      {
-        lValue.set("value", emscripten::val(inductance));
-      }
-      if (resistance != -1)
-      {
-        rValue.set("value", emscripten::val(resistance));
-      }
-      if (timeConstant != -1)
-      {
-        tValue.set("value", emscripten::val(timeConstant));
-      }
 
       addParagraph(info, "The time constant, &#120591, of this system is given by the equation");
       addBigParagraph(info, "&#120591 = 2L/R");
@@ -1481,22 +3089,9 @@ void InitializePage(int i)
       addLabel(info, "tValue", "s");
       addBigParagraph(info, "GOAL: &#120591 > 1 s");
       addParagraph(info, "RECOMMENDED: &#120591 > 30 s");
-      if (circuitCompleted) {
-        enablePlayButton();
-      } else {
-        disablePlayButton();
-      }
-      disableNextButton();
-      nextButtonEnabled = false;
       break;
     }
     case (3):
-      if (circuitCompleted) {
-        enablePlayButton();
-      } else {
-        disablePlayButton();
-      }
-      enableNextButton();
       addParagraph(info, "Would the frequency of an RLC circuit's oscillations be affected by the resistor? Intuitively, it might make sense to think that the resistor would have \"intertia\" and would slow down the oscillations of the RLC circuit. However, that is surprisingly not the case! Remember: the derivation of the oscillations of an LC circuit looks at the derivative of voltage with respect to time. The voltage across the resistor vanishes.");
       break;
     case (4):
@@ -1504,20 +3099,9 @@ void InitializePage(int i)
       emscripten::val cValue = addInputField("cValue", false, 0.1, 0);
       emscripten::val lValue = addInputField("lValue", true, 0.1, 0);
       emscripten::val fValue = addInputField("fValue", true, 0.1, 0);
-      if (capacitance != -1)
-      {
-        cValue.set("value", emscripten::val(capacitance));
-      }
-      if (inductance != -1)
-      {
-        lValue.set("value", emscripten::val(inductance));
-      }
-      if (frequency != -1)
-      {
-        fValue.set("value", emscripten::val(frequency));
-      }
       addParagraph(info, "The frequency of an RLC circuit is equal to");
       addBigParagraph(info, "1/( 2π√(LC) )");
+      addParagraph(info, "if there were no resistance at all. The speaker's resistance slows it down ever so slightly, to √( 1/(LC) - (R/2L)<sup>2</sup> )/2π, which is what is shown below. With too much resistance the circuit would not oscillate at all!");
       addParagraph(info, "The limits of human hearing is 20 to 20000 Hz, but depending on your age and the quality of your speakers, you might not be able to hear it if you put it at a high or low pitch!");
       addLabel(info, "cValue", "C = ", "left-label");
       info.call<emscripten::val>("appendChild", cValue);
@@ -1534,13 +3118,6 @@ void InitializePage(int i)
       addLabel(info, "fValue", "Hz");
       addBigParagraph(info, "GOAL: 20-20000 Hz");
       addBigParagraph(info, "RECOMMENDED: 200-5000 Hz");
-      if (circuitCompleted) {
-        enablePlayButton();
-      } else {
-        disablePlayButton();
-      }
-      disableNextButton();
-      frequency = -1;
       break;
     }
     case (5):
@@ -1554,12 +3131,6 @@ void InitializePage(int i)
       addParagraph(info, "Similarly, when the current points to the left, magnetic field points up and pushes the speaker cone up.");
       addParagraph(info, "The conversion of electrical energy to heat and sound is why a speaker has a resistance as energy cannot be created by the first law of thermodynamics.");
       addParagraph(info, "In this example here, the speaker is vibrating at 440 Hz, the \"Concert A\" note. To more clearly see it, time is slowed by a factor of 1000.");
-      if (circuitCompleted) {
-        enablePlayButton();
-      } else {
-        disablePlayButton();
-      }
-      enableNextButton();
       break;
     case (6):
     {
@@ -1568,26 +3139,6 @@ void InitializePage(int i)
       emscripten::val vValue = addInputField("vValue", false, 0.1, 0);
       emscripten::val pValue = addInputField("pValue", true, 0.1, 0);
       emscripten::val lpValue = addInputField("lpValue", true, 0.1, 0);
-      if (capacitance != -1)
-      {
-        cValue.set("value", emscripten::val(capacitance));
-      }
-      if (inductance != -1)
-      {
-        lValue.set("value", emscripten::val(inductance));
-      }
-      if (volts != -1)
-      {
-        vValue.set("value", emscripten::val(volts));
-      }
-      if (watts != -1)
-      {
-        pValue.set("value", emscripten::val(watts));
-      }
-      if (decibels != -1)
-      {
-        lpValue.set("value", emscripten::val(decibels));
-      }
 
       addParagraph(info, "Adjust your voltage to control the volume. We assume the speaker is 0.5% efficient (audiophiles beware!). dB are being read at 0.55m from the source, because who sits a whole meter away from their speakers? Power is given by");
       addBigParagraph(info, "P = I<sup>2</sup>R = CV<sup>2</sup>/L");
@@ -1616,12 +3167,6 @@ void InitializePage(int i)
       info.call<emscripten::val>("appendChild", lpValue);
       addLabel(info, "lpValue", "dB");
       addBigParagraph(info, "GOAL: 30-70 dB");
-      if (circuitCompleted) {
-        enablePlayButton();
-      } else {
-        disablePlayButton();
-      }
-      disableNextButton();
       break;
     }
     case (7): {
@@ -1634,8 +3179,6 @@ void InitializePage(int i)
       emscripten::val rValue = addInputField("rValue", false, 2, 0, 16, 6);
       emscripten::val sensitivityValue = addInputField("sensitivityValue", false, 0.1, 0, 109.453876, 88);
       emscripten::val efficiencyValue = addInputField("efficiencyValue", true, 0.01);
-      rValue.set("value", emscripten::val(resistance));
-      sensitivityValue.set("value", emscripten::val(efficiency));
 
       addParagraph(info, "Now, we give you the freedom to manipulate the statistics of the speaker.");
       addParagraph(info, "The resistance of the speaker, which would be called the speaker impedance in an AC circuit, controls the time constant and the initial sound volume. Since it changes two key values rather than just one, we have restricted changing its value until now.");
@@ -1661,8 +3204,78 @@ void InitializePage(int i)
       addLabel(info, "efficiencyValue", "∴ ŋ = ", "left-label");
       info.call<emscripten::val>("appendChild", efficiencyValue);
       addLabel(info, "efficiencyValue", "% efficiency");
-      enablePlayButton();
-      enableNextButton();
+      addBreak(info);
+      addBreak(info);
+      addParagraph(info, "Real speakers are not just resistors, though. The voice coil is also an inductor, so treble gets quieter, and the cone is a mass on a spring, so bass below its resonant frequency gets quieter too. Check the box to hear (and see) what that does to your sound.");
+      emscripten::val speakerValue = document.call<emscripten::val>("createElement", emscripten::val("input"));
+      speakerValue.set("id", emscripten::val("speakerValue"));
+      speakerValue.set("type", emscripten::val("checkbox"));
+      emscripten::val leValue = addInputField("leValue", false, 0.1, 0);
+      emscripten::val fsValue = addInputField("fsValue", false, 1, 1);
+      emscripten::val qmsValue = addInputField("qmsValue", false, 0.1, 0.1);
+      emscripten::val qesValue = addInputField("qesValue", false, 0.1, 0.1);
+      emscripten::val zValue = addInputField("zValue", true, 0.01);
+      emscripten::val responseValue = addInputField("responseValue", true, 0.01);
+      info.call<emscripten::val>("appendChild", speakerValue);
+      addLabel(info, "speakerValue", "Model the speaker");
+      addBreak(info);
+      addBreak(info);
+      addLabel(info, "leValue", "L<sub>e</sub> = ", "left-label");
+      info.call<emscripten::val>("appendChild", leValue);
+      addLabel(info, "leValue", "mH");
+      addBreak(info);
+      addBreak(info);
+      addLabel(info, "fsValue", "f<sub>s</sub> = ", "left-label");
+      info.call<emscripten::val>("appendChild", fsValue);
+      addLabel(info, "fsValue", "Hz");
+      addBreak(info);
+      addBreak(info);
+      addLabel(info, "qmsValue", "Q<sub>ms</sub> = ", "left-label");
+      info.call<emscripten::val>("appendChild", qmsValue);
+      addBreak(info);
+      addBreak(info);
+      addLabel(info, "qesValue", "Q<sub>es</sub> = ", "left-label");
+      info.call<emscripten::val>("appendChild", qesValue);
+      addBreak(info);
+      addBreak(info);
+      addLabel(info, "zValue", "∴ |Z| = ", "left-label");
+      info.call<emscripten::val>("appendChild", zValue);
+      addLabel(info, "zValue", "&#8486 at your frequency");
+      addBreak(info);
+      addBreak(info);
+      addLabel(info, "responseValue", "∴ ", "left-label");
+      info.call<emscripten::val>("appendChild", responseValue);
+      addLabel(info, "responseValue", "dB louder at your frequency");
+      addBreak(info);
+      addBreak(info);
+      addParagraph(info, "Real parts are never exactly the value printed on them: capacitors are usually only within ±5–20%. Run the analysis to build 100,000 copies of your circuit out of randomly imperfect parts and see how much the pitch, time constant and loudness spread out.");
+      emscripten::val tolLValue = addInputField("tolLValue", false, 1, 0);
+      addLabel(info, "tolLValue", "L tolerance = ±", "left-label");
+      info.call<emscripten::val>("appendChild", tolLValue);
+      addLabel(info, "tolLValue", "%");
+      addBreak(info);
+      emscripten::val tolValue = addInputField("tolValue", false, 1, 0);
+      addLabel(info, "tolValue", "C tolerance = ±", "left-label");
+      info.call<emscripten::val>("appendChild", tolValue);
+      addLabel(info, "tolValue", "%");
+      addBreak(info);
+      emscripten::val tolRValue = addInputField("tolRValue", false, 1, 0);
+      addLabel(info, "tolRValue", "R tolerance = ±", "left-label");
+      info.call<emscripten::val>("appendChild", tolRValue);
+      addLabel(info, "tolRValue", "%");
+      addBreak(info);
+      emscripten::val tolVValue = addInputField("tolVValue", false, 1, 0);
+      addLabel(info, "tolVValue", "battery tolerance = ±", "left-label");
+      info.call<emscripten::val>("appendChild", tolVValue);
+      addLabel(info, "tolVValue", "%");
+      addBreak(info);
+      addBreak(info);
+      emscripten::val toleranceButton = document.call<emscripten::val>("createElement", emscripten::val("button"));
+      toleranceButton.set("className", emscripten::val("button"));
+      toleranceButton.set("innerHTML", emscripten::val("RUN TOLERANCE ANALYSIS"));
+      toleranceButton.call<void>("addEventListener", emscripten::val("mouseup"), emscripten::val::module_property("RunToleranceAnalysis"));
+      info.call<emscripten::val>("appendChild", toleranceButton);
+      addParagraph(info, "", "toleranceReport");
       break;
     }
     case(8):
@@ -1684,6 +3297,19 @@ void InitializePage(int i)
 
       addParagraph(info, "Time to create a scale! Match each frequency as closely as you can.");
       addParagraph(info, "Match: C", "match");
+      addParagraph(info, "Real capacitors only come in a few standard values, though. The closest you could actually buy is shown below, along with the standard inductor it assumes.");
+      addLabel(info, "eSeries", "Series:", "note-label");
+      emscripten::val seriesSelect = document.call<emscripten::val>("createElement", emscripten::val("select"));
+      seriesSelect.set("id", "eSeries");
+      seriesSelect.set("name", "eSeries");
+      info.call<void>("appendChild", seriesSelect);
+      for (std::string name : {"E12", "E24", "E96"}) {
+        emscripten::val option = document.call<emscripten::val>("createElement", emscripten::val("option"));
+        option.set("value", name);
+        option.set("innerHTML", name);
+        seriesSelect.call<void>("appendChild", option);
+      }
+      addParagraph(info, "", "parts");
       addLabel(info, "c1Value", "C<sub>4</sub>: 261.63 Hz");
       addCapacitorLabelSet(info, c1Value, "c1Value", "1");
       addBreak(info);
@@ -1739,10 +3365,6 @@ void InitializePage(int i)
       addLabel(info, "fValue", "∴ f = ", "left-label");
       info.call<emscripten::val>("appendChild", fValue);
       addLabel(info, "fValue", "Hz");
-      disablePlayButton();
-      playButtonEnabled = false;
-      frequency = -1;
-      enableNextButton();
       break;
     }
     case (9):
@@ -1758,8 +3380,6 @@ void InitializePage(int i)
       addBreak(info);
       addLabel(info, "s2", "Note 2:", "note-label");
       addSelectOctave(info, "s2");
-      enablePlayButton();
-      enableNextButton();
       break;
     case (10):
     {
@@ -1769,8 +3389,18 @@ void InitializePage(int i)
       addLabel(info, "fValue", "f = ", "left-label");
       info.call<emscripten::val>("appendChild", fValue);
       addLabel(info, "fValue", "Hz");
-      enablePlayButton();
-      enableNextButton();
+      addBreak(info);
+      addBreak(info);
+      addParagraph(info, "It works the other way around too: any recorded sound can be taken apart into the harmonics it is made of, each one an RLC circuit. Load a WAV file and play it back as circuits!");
+      emscripten::val sampleFile = document.call<emscripten::val>("createElement", emscripten::val("input"));
+      sampleFile.set("id", "sampleFile");
+      sampleFile.set("type", "file");
+      sampleFile.set("accept", ".wav");
+      sampleFile.call<void>("addEventListener", emscripten::val("change"), emscripten::val::module_property("LoadSampleFile"));
+      addLabel(info, "sampleFile", "WAV file:", "note-label");
+      info.call<void>("appendChild", sampleFile);
+      addParagraph(info, "", "resynthesis");
+      addSpectrogram(info);
       break;
     }
     case(11) :
@@ -1789,24 +3419,110 @@ void InitializePage(int i)
       saw.set("innerHTML", "Sawtooth");
       sel.call<void>("appendChild", saw);
 
-      for(int i = 0; i < 13; i++) {
-        pianoKeys.emplace_back(false);
-        previousKeys.emplace_back(false);
+      addBreak(info);
+      addBreak(info);
+      addLabel(info, "tuning", "Tuning:", "note-label");
+      emscripten::val tuningSelect = document.call<emscripten::val>("createElement", emscripten::val("select"));
+      tuningSelect.set("id", "tuning");
+      tuningSelect.set("name", "tuning");
+      info.call<void>("appendChild", tuningSelect);
+      for (auto [value, name] : {std::make_pair("equal", "Equal temperament"), std::make_pair("just", "Just intonation"), std::make_pair("scala", "Scala file")}) {
+        emscripten::val option = document.call<emscripten::val>("createElement", emscripten::val("option"));
+        option.set("value", value);
+        option.set("innerHTML", name);
+        tuningSelect.call<void>("appendChild", option);
       }
-      audio::remove_all_rlcs();
-      std::unordered_map<boost::uuids::uuid, std::tuple<double, double, double>, boost::hash<boost::uuids::uuid>> defaults;
-      for (int i = 0; i < 13; i++) {
-        std::vector<boost::uuids::uuid> s1;
-        for (int j = 1; j < 11; j++) {
-          boost::uuids::uuid uuid = uuidGenerator();
-          defaults.try_emplace(uuid, std::make_tuple(frequencyArray[i] * j, initialVolume / double(j), timeConstant));
-          s1.emplace_back(uuid);
-        }
-        pianouuids.emplace_back(s1);
+      addBreak(info);
+      addBreak(info);
+      emscripten::val scalaFile = document.call<emscripten::val>("createElement", emscripten::val("input"));
+      scalaFile.set("id", "scalaFile");
+      scalaFile.set("type", "file");
+      scalaFile.set("accept", ".scl");
+      scalaFile.call<void>("addEventListener", emscripten::val("change"), emscripten::val::module_property("LoadScalaFile"));
+      addLabel(info, "scalaFile", "Scala file:", "note-label");
+      info.call<void>("appendChild", scalaFile);
+      addBreak(info);
+      addBreak(info);
+      emscripten::val octaveValue = addInputField("octaveValue", false, 1, 0, 8, 4);
+      addLabel(info, "octaveValue", "Octave:", "note-label");
+      info.call<void>("appendChild", octaveValue);
+      addBreak(info);
+      addBreak(info);
+      addLabel(info, "room", "Room:", "note-label");
+      emscripten::val roomSelect = document.call<emscripten::val>("createElement", emscripten::val("select"));
+      roomSelect.set("id", "room");
+      roomSelect.set("name", "room");
+      info.call<void>("appendChild", roomSelect);
+      for (auto [value, name] : {std::make_pair("none", "None"), std::make_pair("small", "Small room"), std::make_pair("hall", "Concert hall"), std::make_pair("file", "Impulse response file")}) {
+        emscripten::val option = document.call<emscripten::val>("createElement", emscripten::val("option"));
+        option.set("value", value);
+        option.set("innerHTML", name);
+        roomSelect.call<void>("appendChild", option);
       }
-      audio::add_rlcs(defaults);
-      enablePlayButton();
-      disableNextButton();
+      addBreak(info);
+      addBreak(info);
+      emscripten::val roomFile = document.call<emscripten::val>("createElement", emscripten::val("input"));
+      roomFile.set("id", "roomFile");
+      roomFile.set("type", "file");
+      roomFile.set("accept", ".wav");
+      roomFile.call<void>("addEventListener", emscripten::val("change"), emscripten::val::module_property("LoadRoomFile"));
+      addLabel(info, "roomFile", "WAV file:", "note-label");
+      info.call<void>("appendChild", roomFile);
+      addBreak(info);
+      addBreak(info);
+      emscripten::val wetValue = addInputField("wetValue", false, 1, 0, 100, engine::roomWet * 100);
+      addLabel(info, "wetValue", "Wet:", "note-label");
+      info.call<void>("appendChild", wetValue);
+      addLabel(info, "wetValue", "%");
+      addBreak(info);
+      addBreak(info);
+      addLabel(info, "renderer", "Renderer:", "note-label");
+      emscripten::val rendererSelect = document.call<emscripten::val>("createElement", emscripten::val("select"));
+      rendererSelect.set("id", "renderer");
+      rendererSelect.set("name", "renderer");
+      info.call<void>("appendChild", rendererSelect);
+      for (auto [value, name] : {std::make_pair("webaudio", "Web Audio nodes"), std::make_pair("engine", "AnaSynth engine"), std::make_pair("engine32", "AnaSynth engine (32-bit)")}) {
+        emscripten::val option = document.call<emscripten::val>("createElement", emscripten::val("option"));
+        option.set("value", value);
+        option.set("innerHTML", name);
+        rendererSelect.call<void>("appendChild", option);
+      }
+      addBreak(info);
+      addBreak(info);
+      emscripten::val cullValue = addInputField("cullValue", false, 1, -200, 0, engine::cullThreshold);
+      addLabel(info, "cullValue", "Cut off below:", "note-label");
+      info.call<void>("appendChild", cullValue);
+      addLabel(info, "cullValue", "dBFS");
+      addBreak(info);
+      addBreak(info);
+      addLabel(info, "sequencer", "Sequencer:", "note-label");
+      emscripten::val sequencerSelect = document.call<emscripten::val>("createElement", emscripten::val("select"));
+      sequencerSelect.set("id", "sequencer");
+      sequencerSelect.set("name", "sequencer");
+      info.call<void>("appendChild", sequencerSelect);
+      for (auto [value, name] : {std::make_pair("off", "Off"), std::make_pair("steps", "Play the steps"), std::make_pair("up", "Arpeggio up"), std::make_pair("down", "Arpeggio down"), std::make_pair("updown", "Arpeggio up and down")}) {
+        emscripten::val option = document.call<emscripten::val>("createElement", emscripten::val("option"));
+        option.set("value", value);
+        option.set("innerHTML", name);
+        sequencerSelect.call<void>("appendChild", option);
+      }
+      addBreak(info);
+      addBreak(info);
+      emscripten::val tempoValue = addInputField("tempoValue", false, 1, 20, 400, 120);
+      addLabel(info, "tempoValue", "Tempo:", "note-label");
+      info.call<void>("appendChild", tempoValue);
+      addLabel(info, "tempoValue", "BPM");
+      addBreak(info);
+      addBreak(info);
+      // sixteenth notes, named like the octave selects, - for a rest
+      emscripten::val stepsValue = document.call<emscripten::val>("createElement", emscripten::val("input"));
+      stepsValue.set("id", "stepsValue");
+      stepsValue.set("type", "text");
+      addLabel(info, "stepsValue", "Steps:", "note-label");
+      info.call<void>("appendChild", stepsValue);
+      addParagraph(info, "", "sequencerStep");
+      addParagraph(info, "", "culled");
+      addSpectrogram(info);
       break;
     }
     default:
@@ -1815,7 +3531,201 @@ void InitializePage(int i)
   }
 }
 
-void StoreData(int page); // forward declaration
+void EnterPage(int i)
+{
+  // the input values and buttons of a page, restored from state on every visit since the page itself is kept
+  auto field = [](const char* id) {
+    return document.call<emscripten::val>("getElementById", emscripten::val(id));
+  };
+  auto restore = [&field](const char* id, double value) {
+    // -1 is never entered, which leaves the field empty
+    field(id).set("value", value != -1 ? emscripten::val(value) : emscripten::val(""));
+  };
+  spectrogram::show(i == 10 || i == 11);
+  auto playIfCompleted = []() {
+    if (circuitCompleted) {
+      enablePlayButton();
+    } else {
+      disablePlayButton();
+    }
+  };
+  switch(i) {
+    case (0):
+    case (1):
+    case (3):
+    case (5):
+      playIfCompleted();
+      enableNextButton();
+      break;
+    case (2):
+      restore("lValue", inductance);
+      restore("rValue", resistance);
+      restore("tValue", timeConstant);
+      playIfCompleted();
+      disableNextButton();
+      nextButtonEnabled = false;
+      break;
+    case (4):
+      restore("cValue", capacitance);
+      restore("lValue", inductance);
+      restore("fValue", frequency);
+      playIfCompleted();
+      disableNextButton();
+      frequency = -1;
+      break;
+    case (6):
+      restore("lValue", inductance);
+      restore("cValue", capacitance);
+      restore("vValue", volts);
+      restore("pValue", watts);
+      restore("lpValue", decibels);
+      playIfCompleted();
+      disableNextButton();
+      break;
+    case (7):
+      field("rValue").set("value", emscripten::val(resistance));
+      field("sensitivityValue").set("value", emscripten::val(efficiency));
+      field("speakerValue").set("checked", emscripten::val(speakerModeled));
+      field("leValue").set("value", emscripten::val(coilInductance));
+      field("fsValue").set("value", emscripten::val(speakerResonance));
+      field("qmsValue").set("value", emscripten::val(mechanicalQ));
+      field("qesValue").set("value", emscripten::val(electricalQ));
+      field("tolLValue").set("value", emscripten::val(tolerance::tolerances().inductance));
+      field("tolValue").set("value", emscripten::val(tolerance::tolerances().capacitance));
+      field("tolRValue").set("value", emscripten::val(tolerance::tolerances().resistance));
+      field("tolVValue").set("value", emscripten::val(tolerance::tolerances().voltage));
+      enablePlayButton();
+      enableNextButton();
+      break;
+    case (8):
+      // the notes are matched from scratch on every visit
+      for (int note = 1; note <= 13; note++) {
+        emscripten::val capacitor = document.call<emscripten::val>("getElementById", "c" + std::to_string(note) + "Value");
+        capacitor.set("value", emscripten::val(""));
+        capacitor.set("disabled", emscripten::val(false));
+      }
+      scaleNote = 1;
+      field("fValue").set("value", emscripten::val(""));
+      field("match").set("innerHTML", emscripten::val("Match: C4"));
+      // RenderSidebar fills the parts in again whenever they are empty
+      field("parts").set("innerHTML", emscripten::val(""));
+      disablePlayButton();
+      playButtonEnabled = false;
+      frequency = -1;
+      enableNextButton();
+      break;
+    case (9):
+      field("s1").set("selectedIndex", emscripten::val(0));
+      field("s2").set("selectedIndex", emscripten::val(0));
+      enablePlayButton();
+      enableNextButton();
+      break;
+    case (10):
+      field("fValue").set("value", emscripten::val(""));
+      enablePlayButton();
+      enableNextButton();
+      break;
+    case (11):
+      // the keyboard always starts out on middle C in equal temperament
+      field("tuning").set("value", emscripten::val("equal"));
+      field("octaveValue").set("value", emscripten::val(4));
+      field("room").set("value", emscripten::val(audio::roomName));
+      field("wetValue").set("value", emscripten::val(engine::roomWet * 100));
+      field("renderer").set("value", emscripten::val(audio::backend_name()));
+      field("cullValue").set("value", emscripten::val(engine::cullThreshold));
+      {
+        // the sequencer comes back the way it was left, even from an earlier visit to the site
+        emscripten::val localStorage = emscripten::val::global("localStorage");
+        emscripten::val mode = localStorage.call<emscripten::val>("getItem", emscripten::val("sequencerMode"));
+        emscripten::val tempo = localStorage.call<emscripten::val>("getItem", emscripten::val("sequencerTempo"));
+        emscripten::val steps = localStorage.call<emscripten::val>("getItem", emscripten::val("sequencerSteps"));
+        field("sequencer").set("value", mode.typeOf().as<std::string>() == "string" ? mode : emscripten::val("off"));
+        field("tempoValue").set("value", tempo.typeOf().as<std::string>() == "string" ? tempo : emscripten::val(120));
+        field("stepsValue").set("value", steps.typeOf().as<std::string>() == "string" ? steps : emscripten::val(steps_text(engine::pattern())));
+      }
+      keyboardTuning = &tuning::equalTemperament;
+      BuildPianoVoices(tuning::middleC);
+      enablePlayButton();
+      disableNextButton();
+      break;
+    default:
+      break;
+  }
+}
+
+namespace pages
+{
+  // every page's sidebar is built once into its own detached div and swapped into info after that, so coming back
+  // to a page is one DOM call instead of dozens of createElement/appendChild crossings
+  std::map<int, emscripten::val> cache;
+  struct page_switch
+  {
+    int page;
+    bool built; // the first visit, which still builds the page
+    double milliseconds;
+  };
+  // since the last report, but only the newest maxSwitches of them, overwritten oldest first
+  const size_t maxSwitches = 1024;
+  std::vector<page_switch> switches;
+  size_t recorded = 0; // how many there were, kept or not
+  void record(const page_switch& s)
+  {
+    if (switches.size() < maxSwitches) {
+      switches.push_back(s);
+    } else {
+      switches[recorded % maxSwitches] = s;
+    }
+    recorded++;
+  }
+  void clear()
+  {
+    switches.clear();
+    recorded = 0;
+  }
+  std::string report()
+  {
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(3);
+    for (bool built : {true, false}) {
+      std::vector<double> times;
+      for (const page_switch& s : switches) {
+        if (s.built == built) {
+          times.push_back(s.milliseconds);
+        }
+      }
+      if (times.empty()) {
+        continue;
+      }
+      std::sort(times.begin(), times.end());
+      double total = 0;
+      for (double t : times) {
+        total += t;
+      }
+      out << (built ? "page builds: " : "cached page switches: ") << times.size() << ", mean " << total / times.size()
+          << " ms, median " << times[times.size() / 2] << " ms, max " << times.back() << " ms\n";
+    }
+    if (recorded > switches.size()) {
+      out << "(only the last " << switches.size() << " of " << recorded << " page switches)\n";
+    }
+    clear();
+    return out.str();
+  }
+}
+
+void InitializePage(int i)
+{
+  double started = emscripten::val::global("performance").call<double>("now");
+  bool built = !pages::cache.contains(i);
+  if (built) {
+    emscripten::val container = document.call<emscripten::val>("createElement", emscripten::val("div"));
+    BuildPage(i, container);
+    pages::cache.emplace(i, container);
+  }
+  // the page that was showing is detached, not destroyed, and keeps its elements and listeners for the next visit
+  document.call<emscripten::val>("getElementById", emscripten::val("info")).call<void>("replaceChildren", pages::cache.at(i));
+  EnterPage(i);
+  pages::record({i, built, emscripten::val::global("performance").call<double>("now") - started});
+}
 
 void RenderSidebar()
 {
@@ -1851,7 +3761,7 @@ void RenderSidebar()
           }
           boost::uuids::uuid uuid;
           uuid = uuidGenerator();
-          std::unordered_map<boost::uuids::uuid, std::tuple<double, double, double>, boost::hash<boost::uuids::uuid>> defaults = {{uuid, std::make_tuple(frequency, initialVolume, timeConstant)}};
+          audio::rlc_map defaults({{uuid, std::make_tuple(frequency, initialVolume, timeConstant)}}, &frame::memory);
           audio::add_rlcs(defaults);
           inductance = stod(inductor["value"].as<std::string>());
           timeConstant = tV;
@@ -1869,7 +3779,7 @@ void RenderSidebar()
       emscripten::val fr = document.call<emscripten::val>("getElementById", emscripten::val("fValue"));
       double f;
       if (capacitor["value"].as<std::string>() != "") {
-        f = 1 / (2 * pi * sqrt(stod(capacitor["value"].as<std::string>()) / 1000000000 * inductance));
+        f = audio::damped_frequency(inductance, stod(capacitor["value"].as<std::string>()) / 1000000000, resistance);
         if (std::isinf(f)) {
           fr.set("value", emscripten::val("Infinity"));
         } else {
@@ -1883,8 +3793,7 @@ void RenderSidebar()
                 PlayOrPauseSound(emscripten::val(""));
               }
               audio::remove_all_rlcs();
-              std::unordered_map<boost::uuids::uuid, std::tuple<double, double, double>, boost::hash<boost::uuids::uuid>> defaults{
-                      {uuidGenerator(), std::make_tuple(frequency, initialVolume, timeConstant)}};
+              audio::rlc_map defaults({{uuidGenerator(), std::make_tuple(frequency, initialVolume, timeConstant)}}, &frame::memory);
               audio::add_rlcs(defaults);
               StoreData(page);
             }
@@ -1916,7 +3825,7 @@ void RenderSidebar()
             initialVolume = p * audio::decibels_to_watts(efficiency, 1);
             volts = stod(voltage["value"].as<std::string>());
             audio::remove_all_rlcs();
-            std::unordered_map<boost::uuids::uuid, std::tuple<double, double, double>, boost::hash<boost::uuids::uuid>> defaults{{uuidGenerator(), std::make_tuple(frequency, initialVolume, timeConstant)}};
+            audio::rlc_map defaults({{uuidGenerator(), std::make_tuple(frequency, initialVolume, timeConstant)}}, &frame::memory);
             audio::add_rlcs(defaults);
             StoreData(page);
             enableNextButton();
@@ -1937,44 +3846,85 @@ void RenderSidebar()
         double efficiencyValue = audio::decibels_to_watts(stod(sensitivity["value"].as<std::string>()), 1);
         efficiencyVal.set("value", emscripten::val(efficiencyValue*100));
         double r = stod(rValue["value"].as<std::string>());
+        // the voice's pitch and decay come straight from the exact solution with the page 6 battery. the resistance
+        // shifts the frequency too, and past critical damping the circuit stops oscillating at all. voices can only
+        // ring, so a critically damped or overdamped circuit is refused below rather than played, and the loudness
+        // stays the page 6 power rather than V/Lω
         double t = 2 * inductance / r;
-        std::vector<double> f = {frequency};
+        double fr = frequency;
+        if (capacitance > 0) {
+          audio::rlc_response response = audio::solve_rlc(inductance, capacitance / 1000000000, r, volts);
+          t = 1 / response.alpha;
+          fr = response.regime == audio::damping::underdamped ? response.omega / (2*pi) : 0;
+        }
         resistance = r;
         
         // std::cout << std::to_string(watts/4 * r) << std::endl;
-        if(playButtonEnabled && audio::decibels_to_watts(efficiency, 1) * watts / 1000000 > 1) {
-          disablePlayButton("Please lower the volume.");
+        bool tooLoud = audio::decibels_to_watts(efficiency, 1) * watts / 1000000 > 1;
+        if(playButtonEnabled && (tooLoud || fr == 0)) {
+          disablePlayButton(tooLoud ? "Please lower the volume." : "The circuit is overdamped and no longer oscillates. Please lower the resistance.");
           playButtonEnabled = false;
-        } else if (!playButtonEnabled && audio::decibels_to_watts(efficiency, 1) * watts / 1000000 <= 1){
+        } else if (!playButtonEnabled && !tooLoud && fr != 0){
           enablePlayButton(true);
           playButtonEnabled = true;
         }
 
         static std::vector<double> previousVars;
-        std::vector<double> vars = {watts, r, t, stod(efficiencyVal["value"].as<std::string>())};
-        if(previousVars != vars) {
-          //audio::set_vars(f, watts/4 * r, t);
-          // TODO: set vars
+        std::pmr::vector<double> vars({watts, r, t, fr, stod(efficiencyVal["value"].as<std::string>())}, &frame::memory);
+        if(!std::ranges::equal(previousVars, vars)) {
           efficiency = stod(sensitivity["value"].as<std::string>());
           timeConstant = t;
+          if (fr != 0) {
+            frequency = fr;
+          }
           initialVolume = watts * audio::decibels_to_watts(efficiency, 1);
           audio::remove_all_rlcs();
-          std::unordered_map<boost::uuids::uuid, std::tuple<double, double, double>, boost::hash<boost::uuids::uuid>> defaults{{uuidGenerator(), std::make_tuple(frequency, initialVolume, timeConstant)}};
+          audio::rlc_map defaults({{uuidGenerator(), std::make_tuple(frequency, initialVolume, timeConstant)}}, &frame::memory);
           audio::add_rlcs(defaults);
-          previousVars = vars;
+          previousVars.assign(vars.begin(), vars.end());
           StoreData(page);
         }
       }
+      emscripten::val leValue = document.call<emscripten::val>("getElementById", emscripten::val("leValue"));
+      emscripten::val fsValue = document.call<emscripten::val>("getElementById", emscripten::val("fsValue"));
+      emscripten::val qmsValue = document.call<emscripten::val>("getElementById", emscripten::val("qmsValue"));
+      emscripten::val qesValue = document.call<emscripten::val>("getElementById", emscripten::val("qesValue"));
+      if (leValue["value"].as<std::string>() != "" && fsValue["value"].as<std::string>() != "" &&
+          qmsValue["value"].as<std::string>() != "" && qesValue["value"].as<std::string>() != "") {
+        speakerModeled = document.call<emscripten::val>("getElementById", emscripten::val("speakerValue"))["checked"].as<bool>();
+        coilInductance = stod(leValue["value"].as<std::string>());
+        speakerResonance = stod(fsValue["value"].as<std::string>());
+        mechanicalQ = stod(qmsValue["value"].as<std::string>());
+        electricalQ = stod(qesValue["value"].as<std::string>());
+        audio::speaker_parameters speaker = {resistance, coilInductance / 1000, speakerResonance, mechanicalQ, electricalQ};
+        static std::vector<double> previousSpeaker;
+        std::pmr::vector<double> speakerVars({double(speakerModeled), resistance, coilInductance, speakerResonance, mechanicalQ, electricalQ}, &frame::memory);
+        if (coilInductance > 0 && speakerResonance > 0 && mechanicalQ > 0 && electricalQ > 0) {
+          bool speakerChanged = !std::ranges::equal(previousSpeaker, speakerVars);
+          if (speakerChanged && audio::set_speaker_stage(speakerModeled, speaker)) {
+            previousSpeaker.assign(speakerVars.begin(), speakerVars.end());
+          }
+          // designing the stage allocates, so the readouts are only redone when they would change or the page was rebuilt
+          static double previousFrequency = 0;
+          emscripten::val zValue = document.call<emscripten::val>("getElementById", emscripten::val("zValue"));
+          if (frequency > 0 && (speakerChanged || frequency != previousFrequency || zValue["value"]["length"].as<int>() == 0)) {
+            double sampleRate = audio::audioContext.value()["sampleRate"].as<double>();
+            zValue.set("value", emscripten::val(abs(audio::speaker_impedance(speaker, frequency))));
+            document.call<emscripten::val>("getElementById", emscripten::val("responseValue")).set("value", emscripten::val(
+                    audio::speaker_response(audio::design_speaker_stage(speaker, sampleRate), frequency, sampleRate)));
+            previousFrequency = frequency;
+          }
+        }
+      }
       circuitCompleted = true;
       break;
     }
     case 8:
     {
-      static int counter = 1;
       double cv;
       emscripten::val match = document.call<emscripten::val>("getElementById", emscripten::val("match"));
       emscripten::val fValue = document.call<emscripten::val>("getElementById", emscripten::val("fValue"));
-      switch(counter) {
+      switch(scaleNote) {
         case(1):
           match.set("innerHTML", "Match: C4");
           break;
@@ -2017,39 +3967,53 @@ void RenderSidebar()
         default:
           break;
       }
-      if (document.call<emscripten::val>("getElementById", "c" + std::to_string(counter) + "Value")["value"].as<std::string>() != "") {
-        cv = stod(document.call<emscripten::val>("getElementById", "c" + std::to_string(counter) + "Value")["value"].as<std::string>());
-        double f = 1 / (2 * pi * sqrt(cv / 1000000000 * inductance));
+      static std::tuple<std::string, int, double, double> previousParts;
+      emscripten::val partsText = document.call<emscripten::val>("getElementById", emscripten::val("parts"));
+      std::string seriesName = document.call<emscripten::val>("getElementById", emscripten::val("eSeries"))["value"].as<std::string>();
+      bool partsChanged = previousParts != std::make_tuple(seriesName, scaleNote, inductance, resistance) ||
+                          partsText["innerHTML"]["length"].as<int>() == 0;
+      if (scaleNote <= 13 && inductance > 0 && partsChanged) {
+        components::series series = seriesName == "E12" ? components::series::e12 : (seriesName == "E96" ? components::series::e96 : components::series::e24);
+        const components::scale_fit& parts = components::solve_scale_for(tuning::equalTemperament, inductance, resistance, series);
+        std::ostringstream text;
+        text << "Closest " << seriesName << " parts: " << components::describe(parts.keys.at(tuning::middleC + scaleNote - 1))
+             << " with a " << std::setprecision(3) << parts.inductance << " H inductor";
+        partsText.set("innerHTML", text.str());
+        previousParts = std::make_tuple(seriesName, scaleNote, inductance, resistance);
+      }
+      if (document.call<emscripten::val>("getElementById", "c" + std::to_string(scaleNote) + "Value")["value"].as<std::string>() != "") {
+        cv = stod(document.call<emscripten::val>("getElementById", "c" + std::to_string(scaleNote) + "Value")["value"].as<std::string>());
+        double f = audio::damped_frequency(inductance, cv / 1000000000, resistance);
         fValue.set("value", f);
         static std::vector<double> previousVars;
-        std::vector<double>vars = {f, watts, resistance, inductance};
+        std::pmr::vector<double> vars({f, watts, resistance, inductance}, &frame::memory);
         frequency = f;
-        if (previousVars != vars)
+        if (!std::ranges::equal(previousVars, vars))
         {
           if(!playButtonEnabled) {
             enablePlayButton();
             playButtonEnabled = true;
           }
-          std::vector<double>freqs = {f};
+          std::pmr::vector<double> freqs({f}, &frame::memory);
           //audio::set_vars(freqs, watts/4 * resistance, 2*inductance/resistance);
           if (audio::get_playing()) {
             PlayOrPauseSound(emscripten::val(""));
           }
           audio::remove_all_rlcs();
-          std::unordered_map<boost::uuids::uuid, std::tuple<double, double, double>, boost::hash<boost::uuids::uuid>> defaults;
+          audio::rlc_map defaults(&frame::memory);
           for (auto freq : freqs) {
             boost::uuids::uuid uuid = uuidGenerator();
             defaults.try_emplace(uuid, std::make_tuple(freq, initialVolume, timeConstant));
           }
           audio::add_rlcs(defaults);
-          previousVars = vars;
+          previousVars.assign(vars.begin(), vars.end());
           StoreData(page);
         }
 
       
-        if(abs(f - frequencyArray[counter - 1]) < 2) {
-          document.call<emscripten::val>("getElementById", "c" + std::to_string(counter) + "Value").set("disabled", true);
-          counter++;
+        if(abs(f - tuning::equalTemperament[tuning::middleC + scaleNote - 1]) < 2) {
+          document.call<emscripten::val>("getElementById", "c" + std::to_string(scaleNote) + "Value").set("disabled", true);
+          scaleNote++;
         }
       }
       
@@ -2059,22 +4023,22 @@ void RenderSidebar()
     case 9:
     {
       static std::vector<double> previousFreqs;
-      std::vector<double>freqs = {frequencyMap.at(document.call<emscripten::val>("getElementById", emscripten::val("s1"))["value"].as<std::string>())};
-      freqs.emplace_back(frequencyMap.at(document.call<emscripten::val>("getElementById", emscripten::val("s2"))["value"].as<std::string>()));
+      std::pmr::vector<double> freqs({tuning::equalTemperament[noteKeys.at(document.call<emscripten::val>("getElementById", emscripten::val("s1"))["value"].as<std::string>())]}, &frame::memory);
+      freqs.emplace_back(tuning::equalTemperament[noteKeys.at(document.call<emscripten::val>("getElementById", emscripten::val("s2"))["value"].as<std::string>())]);
 
 
-      if (previousFreqs != freqs) {
+      if (!std::ranges::equal(previousFreqs, freqs)) {
         if (audio::get_playing()) {
           PlayOrPauseSound(emscripten::val(""));
         }
         audio::remove_all_rlcs();
-        std::unordered_map<boost::uuids::uuid, std::tuple<double, double, double>, boost::hash<boost::uuids::uuid>> defaults;
+        audio::rlc_map defaults(&frame::memory);
         for (auto freq : freqs) {
           boost::uuids::uuid uuid = uuidGenerator();
           defaults.try_emplace(uuid, std::make_tuple(freq, initialVolume, timeConstant));
         }
         audio::add_rlcs(defaults);
-        previousFreqs = freqs;
+        previousFreqs.assign(freqs.begin(), freqs.end());
         StoreData(page);
       }
       break;
@@ -2091,7 +4055,7 @@ void RenderSidebar()
             PlayOrPauseSound(emscripten::val(""));
           }
           audio::remove_all_rlcs();
-          std::unordered_map<boost::uuids::uuid, std::tuple<double, double, double>, boost::hash<boost::uuids::uuid>> defaults;
+          audio::rlc_map defaults(&frame::memory);
           for (int i = 1; i < 11; i++) {
             boost::uuids::uuid uuid = uuidGenerator();
             defaults.try_emplace(uuid, std::make_tuple(fr * i, initialVolume / double(i), timeConstant));
@@ -2105,27 +4069,91 @@ void RenderSidebar()
     }
     case 11:
     {
-      std::vector<bool> keys = pianoKeys;
-      for(int i = 0; i < 13; i++) {
-        if(previousKeys.at(i) != keys.at(i)) {
-          // std::cout << i << std::endl;
-          std::string waveform = document.call<emscripten::val>("getElementById", emscripten::val("wave"))["value"].as<std::string>();
-          std::vector<boost::uuids::uuid> fr;
-          if(waveform == "sine") {
-            fr = {pianouuids.at(i).at(0)};
-          } else if(waveform == "saw") {
-            for(int j = 1; j < 11; j++) {
-              fr.emplace_back(pianouuids.at(i).at(j-1));
-            }
-          }
-          // if(keys.at(i)) {
-          audio::play_or_stop(fr);
-          // } else if(!keys.at(i)) {
-          //   audio::remove_rlcs(fr);
-          // }
+      static std::string previousTuning = "equal";
+      static int previousOctave = 4;
+      static tuning::table previousScala = scalaTuning;
+      std::string tuningName = document.call<emscripten::val>("getElementById", emscripten::val("tuning"))["value"].as<std::string>();
+      std::string octaveString = document.call<emscripten::val>("getElementById", emscripten::val("octaveValue"))["value"].as<std::string>();
+      int octave = octaveString != "" ? std::clamp(std::stoi(octaveString), 0, 8) : previousOctave;
+      if (tuningName != previousTuning || octave != previousOctave || previousScala != scalaTuning) {
+        keyboardTuning = tuningName == "just" ? &tuning::justIntonation : (tuningName == "scala" ? &scalaTuning : &tuning::equalTemperament);
+        BuildPianoVoices(12 * (octave + 1));
+        previousTuning = tuningName;
+        previousOctave = octave;
+        previousScala = scalaTuning;
+      }
+      static std::string previousRoom = "none";
+      static bool roomInitialized = false;
+      static int previousRoomFileLoads = 0;
+      std::string room = document.call<emscripten::val>("getElementById", emscripten::val("room"))["value"].as<std::string>();
+      if ((room != previousRoom || audio::initialized != roomInitialized || roomFileLoads != previousRoomFileLoads) &&
+          audio::set_room(room)) {
+        previousRoom = room;
+        roomInitialized = audio::initialized;
+        previousRoomFileLoads = roomFileLoads;
+      }
+      audio::set_backend(document.call<emscripten::val>("getElementById", emscripten::val("renderer"))["value"].as<std::string>());
+      std::string cullString = document.call<emscripten::val>("getElementById", emscripten::val("cullValue"))["value"].as<std::string>();
+      if (cullString != "") {
+        // compared after clamping, otherwise a value out of range would resample every envelope on every frame
+        double threshold = std::clamp(stod(cullString), -200.0, 0.0);
+        if (threshold != engine::cullThreshold) {
+          audio::set_cull_threshold(threshold);
+        }
+      }
+      // the sentence is only built when a count changed, or the page was rebuilt without it
+      static std::array<long long, 4> previousCounts = {-1, -1, -1, -1};
+      std::array<long long, 4> counts = {engine::culled.aboveHearing, engine::culled.belowThreshold,
+                                         engine::culled.retired + engine::reported.retired, engine::reported.voices};
+      emscripten::val culledText = document.call<emscripten::val>("getElementById", emscripten::val("culled"));
+      if (counts != previousCounts || culledText["innerHTML"]["length"].as<int>() == 0) {
+        std::string culled = "Skipped " + std::to_string(counts[0]) + " partials too high to hear and " +
+                             std::to_string(counts[1]) + " too quiet to hear, retired " +
+                             std::to_string(counts[2]) + " voices after they faded out. " +
+                             std::to_string(counts[3]) + " engine voices sounding.";
+        culledText.set("innerHTML", emscripten::val(culled));
+        previousCounts = counts;
+      }
+      std::string wetString = document.call<emscripten::val>("getElementById", emscripten::val("wetValue"))["value"].as<std::string>();
+      if (wetString != "" && std::clamp(stod(wetString) / 100, 0.0, 1.0) != engine::roomWet) {
+        double wet = std::clamp(stod(wetString) / 100, 0.0, 1.0);
+        if (audio::send({.type = engine::command::kind::set_room_wet, .wet = wet})) {
+          engine::roomWet = wet;
+        }
+      }
+      // the ui only edits the pattern, the engine plays it. the steps text is compared as a js string so an unchanged
+      // pattern costs no allocation
+      engine::pattern sequence = audio::sequencerPattern;
+      static emscripten::val previousSteps = emscripten::val("");
+      emscripten::val steps = document.call<emscripten::val>("getElementById", emscripten::val("stepsValue"))["value"];
+      if (!steps.strictlyEquals(previousSteps)) {
+        parse_steps(steps.as<std::string>(), sequence);
+        previousSteps = steps;
+      }
+      std::string mode = document.call<emscripten::val>("getElementById", emscripten::val("sequencer"))["value"].as<std::string>();
+      sequence.play = mode == "up" ? engine::pattern::order::up : mode == "down" ? engine::pattern::order::down :
+                      mode == "updown" ? engine::pattern::order::up_down : engine::pattern::order::steps;
+      std::string tempoString = document.call<emscripten::val>("getElementById", emscripten::val("tempoValue"))["value"].as<std::string>();
+      if (tempoString != "") {
+        sequence.tempo = std::clamp(stod(tempoString), 20.0, 400.0);
+      }
+      sequence.partials = document.call<emscripten::val>("getElementById", emscripten::val("wave"))["value"].as<std::string>() == "saw" ? 10 : 1;
+      bool running = mode != "off";
+      if (!(sequence == audio::sequencerPattern) || running != audio::sequencerRunning) {
+        // the keys were made for whatever sample rate there was then. if they do not get through, nothing starts
+        // and the next frame tries again
+        if (!running || audio::sequencerRunning || SendKeyboard()) {
+          audio::set_sequencer(sequence, running);
+          StoreData(page);
         }
       }
-      previousKeys = keys;
+      static long long previousStep = -1;
+      long long step = running && engine::reported.steps > 0 ? (engine::reported.steps - 1) % sequence.length : -1;
+      if (step != previousStep) {
+        std::string text = step >= 0 ? "Step " + std::to_string(step + 1) + " of " + std::to_string(sequence.length) : "";
+        document.call<emscripten::val>("getElementById", emscripten::val("sequencerStep")).set("innerHTML", emscripten::val(text));
+        previousStep = step;
+      }
       break;
     }
     default:
@@ -2135,24 +4163,241 @@ void RenderSidebar()
 
 void Render()
 {
+  frame::begin();
   RenderCanvas();
   RenderSidebar();
+  audio::reclaim_finished_voices();
+  engine::poll_telemetry();
+  latency::poll();
+  spectrogram::update();
+  frame::end();
 }
 
 extern "C"
 {
-EMSCRIPTEN_KEEPALIVE
-void SelectPage(int i)
+void ShowPage(int i)
 {
   page = i;
   InitializePage(page);
   StoreData(page);
   document.call<emscripten::val>("getElementById", emscripten::val("b" + std::to_string(page+1))).call<void>("setAttribute", emscripten::val("checked"), emscripten::val("checked"));
 }
+EMSCRIPTEN_KEEPALIVE
+void SelectPage(int i)
+{
+  session::record('p', std::to_string(i));
+  ShowPage(i);
+}
 void NextPage(emscripten::val event)
 {
-  SelectPage(++page);
+  session::record('n', "");
+  ShowPage(page + 1);
+}
+}
+
+namespace session
+{
+  // replays are stepped in whole 60 fps frames, and every frame also renders the engine audio it would have produced
+  const double frameInterval = 1000.0 / 60;
+  const double tail = 1000; // ms rendered after the last event
+  double wall_now()
+  {
+    return emscripten::val::global("performance").call<double>("now");
+  }
+  void dispatch(const entry& e)
+  {
+    std::istringstream fields(e.data);
+    switch (e.kind) {
+      case 'k': {
+        char direction;
+        int keyCode;
+        fields >> direction >> keyCode;
+        emscripten::val event = emscripten::val::object();
+        event.set("type", emscripten::val(direction == 'd' ? "keydown" : "keyup"));
+        event.set("keyCode", emscripten::val(keyCode));
+        event.set("repeat", emscripten::val(false));
+        event.set("timeStamp", emscripten::val(fixedTime.value()));
+        InteractWithKeyboard(event);
+        break;
+      }
+      case 'p': {
+        int i;
+        fields >> i;
+        SelectPage(i);
+        break;
+      }
+      case 'n':
+        NextPage(emscripten::val::undefined());
+        break;
+      case 'P':
+        PlayOrPauseSound(emscripten::val(""));
+        break;
+      case 'i': {
+        std::string id, value;
+        fields >> id;
+        std::getline(fields >> std::ws, value);
+        emscripten::val field = document.call<emscripten::val>("getElementById", emscripten::val(id));
+        if (field.isNull()) {
+          std::cout << "replay: no field " << id << "\n";
+        } else if (field["type"].as<std::string>() == "checkbox") {
+          field.set("checked", emscripten::val(value == "1"));
+        } else {
+          field.set("value", emscripten::val(value));
+        }
+        break;
+      }
+      default:
+        std::cout << "replay: unknown event " << e.kind << "\n";
+    }
+  }
+  struct profile
+  {
+    std::vector<double> frameTimes; // wall ms of every Render()
+    double audioMilliseconds = 0; // wall ms spent in engine::process
+    double audioSeconds = 0; // of audio rendered
+    long long allocations = 0; // heap allocations made inside Render()
+    int allocatingFrames = 0; // frames that made any
+  };
+  std::vector<double> audioBlock;
+  double pendingSamples = 0;
+  void step(profile& p)
+  {
+    double started = wall_now();
+    Render();
+    p.frameTimes.push_back(wall_now() - started);
+    p.allocations += frame::lastAllocations;
+    p.allocatingFrames += frame::lastAllocations > 0;
+    if (audio::engineConnected) {
+      pendingSamples += frameInterval / 1000 * engine::sampleRate;
+      started = wall_now();
+      while (pendingSamples >= engine::partitionSize) {
+        audioBlock.assign(engine::partitionSize, 0);
+        engine::process(audioBlock);
+        pendingSamples -= engine::partitionSize;
+        p.audioSeconds += engine::partitionSize / engine::sampleRate;
+      }
+      p.audioMilliseconds += wall_now() - started;
+    }
+    fixedTime.value() += frameInterval;
+  }
+  double percentile(std::vector<double> values, double fraction)
+  {
+    std::sort(values.begin(), values.end());
+    return values.empty() ? 0 : values.at(std::max(0, int(ceil(fraction * values.size())) - 1));
+  }
+  std::string report(const profile& p, int events, double wallMilliseconds)
+  {
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(3);
+    out << "replayed " << events << " events over " << p.frameTimes.size() << " frames in " << wallMilliseconds << " ms\n";
+    double total = 0;
+    for (double t : p.frameTimes) {
+      total += t;
+    }
+    out << "frame time: mean " << (p.frameTimes.empty() ? 0 : total / p.frameTimes.size()) << " ms, median " << percentile(p.frameTimes, 0.5)
+        << " ms, p99 " << percentile(p.frameTimes, 0.99) << " ms, max " << percentile(p.frameTimes, 1) << " ms\n";
+    out << "heap allocations: " << p.allocations << ", in " << p.allocatingFrames << " of " << p.frameTimes.size() << " frames\n";
+    if (p.audioSeconds > 0) {
+      out << "engine: " << p.audioSeconds << " s of audio in " << p.audioMilliseconds << " ms, "
+          << p.audioMilliseconds / (10 * p.audioSeconds) << "% of real time\n";
+    }
+    return out.str();
+  }
+  std::string replay(const std::string& text)
+  {
+    if (!audio::initialized) {
+      return "Error: close the intro first, the replay needs the audio started\n";
+    }
+    std::vector<entry> entries = parse(text);
+    double started = wall_now();
+    fixedTime = started;
+    audioOffset = audio::audioContext.value()["currentTime"].as<double>() - started / 1000;
+    // nothing replayed is meant to be heard, and Web Audio voices land at whatever time the fixed clock says
+    audio::outputBus.value()["gain"].set("value", emscripten::val(0));
+    engine::live.currentSample = llround(audio::now() * engine::sampleRate);
+    pendingSamples = 0;
+    pages::clear();
+    profile p;
+    for (const entry& e : entries) {
+      while (fixedTime.value() + frameInterval <= started + e.time) {
+        step(p);
+      }
+      dispatch(e);
+    }
+    double end = fixedTime.value() + tail;
+    while (fixedTime.value() < end) {
+      step(p);
+    }
+    fixedTime.reset();
+    std::vector<boost::uuids::uuid> sounding(audio::activeVoices.begin(), audio::activeVoices.end());
+    audio::stop(sounding, audio::now());
+    audio::send({.type = engine::command::kind::stop_all_voices});
+    audio::outputBus.value()["gain"].set("value", emscripten::val(1));
+    std::string result = report(p, entries.size(), wall_now() - started) + pages::report();
+    std::cout << result;
+    return result;
+  }
+}
+
+void StartRecording()
+{
+  session::recording = true;
+  session::log.clear();
+  session::recordingStart = session::performance_now();
+  // so the replay starts on the same page
+  session::record('p', std::to_string(page));
 }
+std::string StopRecording()
+{
+  // the log is also kept in localStorage, where ReplaySession("") finds it
+  session::recording = false;
+  std::string text = session::serialize(session::log);
+  emscripten::val::global("localStorage").call<void>("setItem", emscripten::val("session"), emscripten::val(text));
+  return text;
+}
+std::string FastMathReport()
+{
+  std::string report = fastmath::report();
+  std::cout << report;
+  return report;
+}
+std::string PageSwitchReport()
+{
+  std::string report = pages::report();
+  std::cout << report;
+  return report;
+}
+std::string FrameAllocationReport()
+{
+  std::string report = frame::report();
+  std::cout << report;
+  return report;
+}
+std::string EngineAccuracyReport(double seconds)
+{
+  std::string report = engine::accuracy_report(seconds);
+  std::cout << report;
+  return report;
+}
+std::string ReplaySession(std::string text)
+{
+  // from the console: Module.StartRecording(), play around, Module.StopRecording(), then Module.ReplaySession("")
+  if (text.empty()) {
+    emscripten::val stored = emscripten::val::global("localStorage").call<emscripten::val>("getItem", emscripten::val("session"));
+    text = stored.isNull() ? "" : stored.as<std::string>();
+  }
+  return session::replay(text);
+}
+void RecordInput(emscripten::val event)
+{
+  emscripten::val target = event["target"];
+  std::string id = target["id"].isUndefined() ? "" : target["id"].as<std::string>();
+  std::string type = target["type"].isUndefined() ? "" : target["type"].as<std::string>();
+  // files cannot be replayed from a text log
+  if (id.empty() || type == "file") {
+    return;
+  }
+  session::record('i', id + " " + (type == "checkbox" ? std::string(target["checked"].as<bool>() ? "1" : "0") : target["value"].as<std::string>()));
 }
 
 void StoreData(int page)
@@ -2189,6 +4434,14 @@ void StoreData(int page)
     temp.pop_back();
   }
   localStorage.call<void>("setItem", emscripten::val("timeConstants"), emscripten::val(temp));
+  // the sequencer, as it reads in its fields
+  const engine::pattern& sequence = audio::sequencerPattern;
+  std::string mode = !audio::sequencerRunning ? "off" : sequence.play == engine::pattern::order::up ? "up" :
+                     sequence.play == engine::pattern::order::down ? "down" :
+                     sequence.play == engine::pattern::order::up_down ? "updown" : "steps";
+  localStorage.call<void>("setItem", emscripten::val("sequencerMode"), emscripten::val(mode));
+  localStorage.call<void>("setItem", emscripten::val("sequencerTempo"), emscripten::val(sequence.tempo));
+  localStorage.call<void>("setItem", emscripten::val("sequencerSteps"), emscripten::val(steps_text(sequence)));
 }
 
 void RetrieveData()
@@ -2240,7 +4493,7 @@ void RetrieveData()
     timeConstants = {1.5, 1.5, 1.5};
   }
 
-  std::unordered_map<boost::uuids::uuid, std::tuple<double, double, double>, boost::hash<boost::uuids::uuid>> insertion;
+  audio::rlc_map insertion;
   for (int i = 0; i < frequencies.size(); i++)
   {
     boost::uuids::uuid uuid = uuidGenerator();
@@ -2281,6 +4534,9 @@ int main() {
   document.call<void>("addEventListener",
                       emscripten::val("keyup"),
                       emscripten::val::module_property("InteractWithKeyboard"));
+  document.call<void>("addEventListener",
+                      emscripten::val("input"),
+                      emscripten::val::module_property("RecordInput"));
 
 
   emscripten::val canvas = document.call<emscripten::val>("getElementById", emscripten::val("canvas"));
@@ -2308,7 +4564,23 @@ EMSCRIPTEN_BINDINGS(bindings)
   emscripten::function("ResizeCanvas", ResizeCanvas);
   emscripten::function("SelectPage", SelectPage);
   emscripten::function("NextPage", NextPage);
-  emscripten::function("VolumeControl", audio::volume_control);
   emscripten::function("PlayOrPauseSound", PlayOrPauseSound);
   emscripten::function("CloseIntro", CloseIntro);
+  emscripten::function("RunLatencyProbe", RunLatencyProbe);
+  emscripten::function("RunToleranceAnalysis", RunToleranceAnalysis);
+  emscripten::function("StartRecording", StartRecording);
+  emscripten::function("StopRecording", StopRecording);
+  emscripten::function("ReplaySession", ReplaySession);
+  emscripten::function("EngineAccuracyReport", EngineAccuracyReport);
+  emscripten::function("FastMathReport", FastMathReport);
+  emscripten::function("FrameAllocationReport", FrameAllocationReport);
+  emscripten::function("PageSwitchReport", PageSwitchReport);
+  emscripten::function("RecordInput", RecordInput);
+  emscripten::function("LoadScala", LoadScala);
+  emscripten::function("LoadScalaFile", LoadScalaFile);
+  emscripten::function("ProcessAudio", ProcessAudio);
+  emscripten::function("LoadRoom", LoadRoom);
+  emscripten::function("LoadRoomFile", LoadRoomFile);
+  emscripten::function("LoadSample", LoadSample);
+  emscripten::function("LoadSampleFile", LoadSampleFile);
 }
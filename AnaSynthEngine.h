@@ -0,0 +1,1375 @@
+// the sound engine and the fast math it runs on, without any browser code, shared by AnaSynth.cpp and the native
+// AnaSynthRender. like the rest of AnaSynth it is meant to be included by exactly one translation unit per program
+#pragma once
+
+#include <vector>
+#include <span>
+#include <array>
+#include <complex>
+#include <unordered_map>
+#include <optional>
+#include <memory>
+#include <atomic>
+#include <random>
+#include <cmath>
+#include <algorithm>
+#include <numbers>
+#include <bit>
+#include <cstdint>
+#include <string>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <thread>
+
+namespace fastmath
+{
+  // branch-free polynomial stand-ins for the libm calls in the per-voice and per-point loops, so those loops vectorize.
+  // the error bounds below were measured against libm over the stated ranges, report() measures them again
+  const double ln2 = std::numbers::ln2;
+  inline double exp2(double x)
+  {
+    // relative error below 1e-11 for x in [-1022, 1023], clamped outside of that
+    x = std::clamp(x, -1022.0, 1023.0);
+    double n = floor(x + 0.5);
+    double f = (x - n) * ln2; // within ±ln2/2
+    // Taylor series of e^f up to f^9, in Horner form
+    double p = 1 + f * (1 + f * (1.0 / 2 + f * (1.0 / 6 + f * (1.0 / 24 + f * (1.0 / 120 + f * (1.0 / 720
+               + f * (1.0 / 5040 + f * (1.0 / 40320 + f * (1.0 / 362880)))))))));
+    return p * std::bit_cast<double>(uint64_t(int64_t(n) + 1023) << 52);
+  }
+  inline double exp(double x)
+  {
+    // same relative error as exp2
+    return exp2(x * std::numbers::log2e);
+  }
+  inline double sin(double x)
+  {
+    // absolute error below 1e-11 after range reduction. the reduction itself is exact to about |x| * 2^-53,
+    // the same as for libm once x has been rounded to a double
+    double q = floor(x * std::numbers::inv_pi + 0.5);
+    // π split in two so q*π is subtracted without losing the low bits
+    double r = (x - q * 3.141592653589793116) - q * 1.2246467991473532e-16; // within ±π/2
+    double half = q * 0.5;
+    double sign = 1 - 4 * (half - floor(half)); // -1 for odd q, since sin(x + qπ) = (-1)^q sin(x)
+    double r2 = r * r;
+    // Taylor series of sin up to r^15
+    double p = r * (1 + r2 * (-1.0 / 6 + r2 * (1.0 / 120 + r2 * (-1.0 / 5040 + r2 * (1.0 / 362880
+               + r2 * (-1.0 / 39916800 + r2 * (1.0 / 6227020800 + r2 * (-1.0 / 1307674368000))))))));
+    return sign * p;
+  }
+  inline double cos(double x)
+  {
+    // same error as sin
+    return sin(x + std::numbers::pi / 2);
+  }
+  inline double log10(double x)
+  {
+    // relative error below 2e-12 for positive normal x. 0, negative, infinite and denormal inputs are not handled
+    uint64_t bits = std::bit_cast<uint64_t>(x);
+    double exponent = double(int64_t(bits >> 52 & 0x7ff) - 1023);
+    double mantissa = std::bit_cast<double>((bits & 0xfffffffffffffull) | 0x3ff0000000000000ull); // in [1, 2)
+    // centre the mantissa on 1, in [√½, √2)
+    double high = mantissa > std::numbers::sqrt2 ? 1 : 0;
+    mantissa *= 1 - 0.5 * high;
+    exponent += high;
+    // ln m = 2 atanh(s) with s = (m - 1)/(m + 1), |s| < 0.172
+    double s = (mantissa - 1) / (mantissa + 1);
+    double s2 = s * s;
+    double lnMantissa = 2 * s * (1 + s2 * (1.0 / 3 + s2 * (1.0 / 5 + s2 * (1.0 / 7 + s2 * (1.0 / 9 + s2 * (1.0 / 11 + s2 * (1.0 / 13)))))));
+    return (exponent * ln2 + lnMantissa) * (std::numbers::log10e);
+  }
+  std::string report()
+  {
+    // max error against libm, and the time per call of both over the same arguments
+    const int count = 1 << 16;
+    std::vector<double> arguments(count);
+    std::mt19937_64 generator(1);
+    std::ostringstream out;
+    out << std::setprecision(3);
+    auto measure = [&](const char* name, double low, double high, bool relative, auto fast, auto reference) {
+      std::uniform_real_distribution<double> range(low, high);
+      for (double& x : arguments) {
+        x = range(generator);
+      }
+      double worst = 0;
+      for (double x : arguments) {
+        double error = std::abs(fast(x) - reference(x));
+        worst = std::max(worst, relative ? error / std::abs(reference(x)) : error);
+      }
+      // both sums end up in the report, which is what keeps the timed loops from being optimized away
+      auto started = std::chrono::steady_clock::now();
+      double fastSum = 0;
+      for (double x : arguments) {
+        fastSum += fast(x);
+      }
+      double fastNanoseconds = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - started).count() / count;
+      started = std::chrono::steady_clock::now();
+      double referenceSum = 0;
+      for (double x : arguments) {
+        referenceSum += reference(x);
+      }
+      double referenceNanoseconds = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - started).count() / count;
+      out << name << " on [" << low << ", " << high << "]: max " << (relative ? "relative" : "absolute") << " error " << worst
+          << ", mean " << fastSum / count << " against " << referenceSum / count << ", " << fastNanoseconds
+          << " ns against " << referenceNanoseconds << " ns for libm\n";
+    };
+    measure("exp", -700, 700, true, [](double x) { return fastmath::exp(x); }, [](double x) { return std::exp(x); });
+    measure("exp2", -1000, 1000, true, [](double x) { return fastmath::exp2(x); }, [](double x) { return std::exp2(x); });
+    measure("sin", -1000, 1000, false, [](double x) { return fastmath::sin(x); }, [](double x) { return std::sin(x); });
+    measure("cos", -1000, 1000, false, [](double x) { return fastmath::cos(x); }, [](double x) { return std::cos(x); });
+    measure("log10", 1e-300, 1e300, true, [](double x) { return fastmath::log10(x); }, [](double x) { return std::log10(x); });
+    measure("log10", 1e-6, 10, true, [](double x) { return fastmath::log10(x); }, [](double x) { return std::log10(x); });
+    return out.str();
+  }
+}
+
+namespace circuit
+{
+  // the series RLC circuit each voice is, solved in closed form. the unit tests in tests/circuit_test.cpp check it
+  // against a numerical integration of the ODE
+  using std::numbers::pi;
+  enum class damping { underdamped, critically_damped, overdamped };
+  struct rlc_response
+  {
+    // exact current of a series RLC circuit whose capacitor starts charged and whose current starts at 0:
+    // underdamped:       i(t) = amplitude * e^-αt * sin(ωt), ω = √(1/LC - α²)
+    // critically damped: i(t) = amplitude * e^-αt * t
+    // overdamped:        i(t) = amplitude * e^-αt * sinh(ωt), ω = √(α² - 1/LC)
+    damping regime;
+    double alpha; // R/2L in 1/s, so the envelope time constant is 1/α = 2L/R
+    double omega; // in rad/s
+    double amplitude;
+  };
+  rlc_response solve_rlc(double inductance, double capacitance, double resistance, double voltage)
+  {
+    // SI units: H, F, Ω, V. from L di/dt + Ri + q/C = 0 with i(0) = 0 and L di/dt(0) = V
+    double alpha = resistance / (2 * inductance);
+    double naturalSquared = 1 / (inductance * capacitance);
+    double difference = naturalSquared - alpha * alpha;
+    // anything this close to critical would lose all its digits to cancellation, and sin(ωt)/ω -> t anyway
+    if (std::abs(difference) <= 1e-12 * naturalSquared) {
+      return {damping::critically_damped, alpha, 0, voltage / inductance};
+    } else if (difference > 0) {
+      double omega = sqrt(difference);
+      return {damping::underdamped, alpha, omega, voltage / (inductance * omega)};
+    } else {
+      double omega = sqrt(-difference);
+      return {damping::overdamped, alpha, omega, voltage / (inductance * omega)};
+    }
+  }
+  rlc_response solve_rlc(double frequency, double initialVolume, double timeConstant)
+  {
+    // the (frequency, initial volume, time constant) triples add_rlcs takes are always underdamped
+    return {damping::underdamped, 1 / timeConstant, 2*pi*frequency, initialVolume};
+  }
+  double damped_frequency(double inductance, double capacitance, double resistance)
+  {
+    // in Hz, 0 when the circuit does not oscillate at all
+    rlc_response response = solve_rlc(inductance, capacitance, resistance, 1);
+    return response.regime == damping::underdamped ? response.omega / (2*pi) : 0;
+  }
+  void rlc_currents(std::span<const rlc_response> circuits, std::span<const double> times, std::span<double> out)
+  {
+    // out[k] = current of circuits[k] at times[k] seconds after it started
+    // one branch-free pass so it vectorizes across circuits; the overdamped sinh is split into two decaying exponentials
+    // so that e^-αt * e^ωt never overflows for large R
+    for (size_t k = 0; k < circuits.size(); k++)
+    {
+      const rlc_response& c = circuits[k];
+      double t = times[k];
+      double envelope = fastmath::exp(-c.alpha * t);
+      double under = envelope * fastmath::sin(c.omega * t);
+      double critical = envelope * t;
+      double overOmega = c.regime == damping::overdamped ? c.omega : 0;
+      double over = (fastmath::exp((overOmega - c.alpha) * t) - fastmath::exp(-(overOmega + c.alpha) * t)) / 2;
+      double shape = c.regime == damping::underdamped ? under : (c.regime == damping::overdamped ? over : critical);
+      out[k] = c.amplitude * shape;
+    }
+  }
+}
+
+namespace engine
+{
+  // sample-by-sample dsp that runs in wasm instead of inside Web Audio nodes, fed by audio::engineNode.
+  // nothing in here knows about the browser, so AnaSynthRender runs the same code natively
+  using complex = std::complex<double>;
+  using std::numbers::pi;
+  // the tolerance analysis and the resynthesis spread their work over every core with these
+  int thread_count()
+  {
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+    // no SharedArrayBuffer without -pthread, so std::thread would only throw. emcc.sh builds with it, which needs the
+    // page served cross-origin isolated, see server.sh
+    return 1;
+#else
+    return std::max(1u, std::thread::hardware_concurrency());
+#endif
+  }
+  template<typename Body>
+  void parallel_for(int count, int threads, Body body)
+  {
+    // body(begin, end, thread) on contiguous chunks, chunk 0 runs on the calling thread
+    auto chunk = [count, threads](int t) { return (long long) count * t / threads; };
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+    body(0, count, 0);
+#else
+    std::vector<std::thread> workers;
+    for (int t = 1; t < threads; t++) {
+      workers.emplace_back(body, chunk(t), chunk(t + 1), t);
+    }
+    body(0, chunk(1), 0);
+    for (std::thread& worker : workers) {
+      worker.join();
+    }
+#endif
+  }
+  struct fft_plan
+  {
+    size_t size; // always a power of two
+    std::vector<size_t> bitReversed;
+    std::vector<complex> twiddles; // e^(-2πik/size) for k < size/2
+  };
+  fft_plan make_fft_plan(size_t size)
+  {
+    fft_plan plan{size, std::vector<size_t>(size), std::vector<complex>(size / 2)};
+    int bits = 0;
+    while ((size_t(1) << bits) < size) {
+      bits++;
+    }
+    for (size_t i = 0; i < size; i++) {
+      size_t reversed = 0;
+      for (int b = 0; b < bits; b++) {
+        reversed |= ((i >> b) & 1) << (bits - 1 - b);
+      }
+      plan.bitReversed[i] = reversed;
+    }
+    for (size_t k = 0; k < size / 2; k++) {
+      plan.twiddles[k] = std::polar(1.0, -2 * pi * k / size);
+    }
+    return plan;
+  }
+  const fft_plan& fft_plan_for(size_t size)
+  {
+    // every transform of the same size on a thread shares one plan. the map is node based, so the references stay valid
+    static thread_local std::unordered_map<size_t, fft_plan> plans;
+    auto found = plans.find(size);
+    if (found == plans.end()) {
+      found = plans.emplace(size, make_fft_plan(size)).first;
+    }
+    return found->second;
+  }
+  void fft(std::span<complex> data, bool inverse, const fft_plan& plan)
+  {
+    // in-place iterative radix-2, the inverse includes the 1/n. data is exactly plan.size long
+    size_t n = plan.size;
+    for (size_t i = 0; i < n; i++) {
+      if (i < plan.bitReversed[i]) {
+        std::swap(data[i], data[plan.bitReversed[i]]);
+      }
+    }
+    for (size_t length = 2; length <= n; length *= 2) {
+      size_t half = length / 2;
+      size_t stride = n / length;
+      for (size_t start = 0; start < n; start += length) {
+        for (size_t k = 0; k < half; k++) {
+          complex w = inverse ? std::conj(plan.twiddles[k * stride]) : plan.twiddles[k * stride];
+          complex a = data[start + k];
+          complex b = data[start + k + half] * w;
+          data[start + k] = a + b;
+          data[start + k + half] = a - b;
+        }
+      }
+    }
+    if (inverse) {
+      for (complex& x : data) {
+        x /= double(n);
+      }
+    }
+  }
+  void fft(std::span<complex> data, bool inverse)
+  {
+    fft(data, inverse, fft_plan_for(data.size()));
+  }
+
+  struct partitioned_convolver
+  {
+    // uniformly partitioned overlap-save: the impulse response is cut into blockSize pieces, each pre-transformed once.
+    // every block then costs one forward and one inverse FFT of 2*blockSize plus one multiply-add per partition,
+    // the same amount of work every block no matter where in the response the energy is
+    size_t blockSize = 0;
+    fft_plan plan; // for 2*blockSize, made with the convolver so the renderer never has to make one
+    std::vector<std::vector<complex>> partitions;
+    std::vector<std::vector<complex>> history; // spectra of the last partitions.size() input blocks, a ring
+    size_t newest = 0;
+    std::vector<double> input; // previous block followed by the current one
+    std::vector<complex> scratch;
+  };
+  partitioned_convolver make_convolver(std::span<const double> impulse, size_t blockSize)
+  {
+    partitioned_convolver c;
+    c.blockSize = blockSize;
+    c.plan = make_fft_plan(2 * blockSize);
+    size_t count = std::max<size_t>(1, (impulse.size() + blockSize - 1) / blockSize);
+    c.partitions.assign(count, std::vector<complex>(2 * blockSize));
+    c.history.assign(count, std::vector<complex>(2 * blockSize));
+    c.input.assign(2 * blockSize, 0);
+    c.scratch.resize(2 * blockSize);
+    for (size_t p = 0; p < count; p++) {
+      for (size_t i = 0; i < blockSize && p * blockSize + i < impulse.size(); i++) {
+        c.partitions[p][i] = impulse[p * blockSize + i];
+      }
+      fft(c.partitions[p], false, c.plan);
+    }
+    return c;
+  }
+  void convolve_block(partitioned_convolver& c, std::span<const double> in, std::span<double> out)
+  {
+    // in and out are exactly blockSize samples, out may alias in
+    size_t b = c.blockSize;
+    std::copy(c.input.begin() + b, c.input.end(), c.input.begin());
+    std::copy(in.begin(), in.end(), c.input.begin() + b);
+    c.newest = (c.newest + 1) % c.history.size();
+    std::vector<complex>& spectrum = c.history[c.newest];
+    std::copy(c.input.begin(), c.input.end(), spectrum.begin());
+    fft(spectrum, false, c.plan);
+    // everything is real, so only bins 0..b are accumulated and the rest is mirrored from them
+    std::fill(c.scratch.begin(), c.scratch.end(), complex(0));
+    for (size_t p = 0; p < c.partitions.size(); p++) {
+      const std::vector<complex>& x = c.history[(c.newest + c.history.size() - p) % c.history.size()];
+      const std::vector<complex>& h = c.partitions[p];
+      for (size_t k = 0; k <= b; k++) {
+        c.scratch[k] += x[k] * h[k];
+      }
+    }
+    for (size_t k = 1; k < b; k++) {
+      c.scratch[2 * b - k] = std::conj(c.scratch[k]);
+    }
+    fft(c.scratch, true, c.plan);
+    for (size_t i = 0; i < b; i++) {
+      out[i] = c.scratch[b + i].real();
+    }
+  }
+
+  struct wav
+  {
+    double sampleRate;
+    std::vector<double> samples; // every channel mixed down to one
+  };
+  std::optional<wav> parse_wav(std::span<const uint8_t> bytes)
+  {
+    // RIFF WAVE with 8/16/24/32-bit integer or 32/64-bit float samples, WAVE_FORMAT_EXTENSIBLE included
+    auto read = [&bytes](size_t at, int size) {
+      uint64_t value = 0;
+      for (int i = 0; i < size; i++) {
+        value |= uint64_t(bytes[at + i]) << (8 * i);
+      }
+      return value;
+    };
+    auto tag = [&bytes](size_t at, const char* name) {
+      return std::equal(name, name + 4, bytes.begin() + at);
+    };
+    if (bytes.size() < 12 || !tag(0, "RIFF") || !tag(8, "WAVE")) {
+      return std::nullopt;
+    }
+    int format = 0, channels = 0, bits = 0;
+    double sampleRate = 0;
+    std::span<const uint8_t> data;
+    for (size_t at = 12; at + 8 <= bytes.size();) {
+      size_t size = read(at + 4, 4);
+      size_t body = at + 8;
+      // written so nothing wraps when size_t is 32 bits wide and a chunk claims up to 0xFFFFFFFF bytes.
+      // a truncated last chunk keeps what is there, and at ends up at most one past the end
+      if (size > bytes.size() - body) {
+        size = bytes.size() - body;
+      }
+      if (tag(at, "fmt ") && size >= 16) {
+        format = read(body, 2);
+        channels = read(body + 2, 2);
+        sampleRate = read(body + 4, 4);
+        bits = read(body + 14, 2);
+        if (format == 0xFFFE && size >= 26) {
+          format = read(body + 24, 2);
+        }
+      } else if (tag(at, "data")) {
+        data = bytes.subspan(body, size);
+      }
+      at = body + size + (size & 1);
+    }
+    bool integer = format == 1 && (bits == 8 || bits == 16 || bits == 24 || bits == 32);
+    bool floating = format == 3 && (bits == 32 || bits == 64);
+    if ((!integer && !floating) || channels <= 0 || sampleRate <= 0 || data.empty()) {
+      return std::nullopt;
+    }
+    int width = bits / 8;
+    size_t frames = data.size() / (width * channels);
+    wav result{sampleRate, std::vector<double>(frames)};
+    for (size_t f = 0; f < frames; f++) {
+      double sum = 0;
+      for (int ch = 0; ch < channels; ch++) {
+        size_t at = (f * channels + ch) * width;
+        uint64_t raw = 0;
+        for (int i = 0; i < width; i++) {
+          raw |= uint64_t(data[at + i]) << (8 * i);
+        }
+        if (floating) {
+          if (bits == 32) {
+            sum += std::bit_cast<float>(uint32_t(raw));
+          } else {
+            sum += std::bit_cast<double>(raw);
+          }
+        } else if (bits == 8) {
+          sum += (double(raw) - 128) / 128; // 8-bit wav is the only unsigned one
+        } else {
+          int64_t value = int64_t(raw << (64 - bits)) >> (64 - bits);
+          sum += double(value) / double(int64_t(1) << (bits - 1));
+        }
+      }
+      result.samples[f] = sum / channels;
+    }
+    return result;
+  }
+  std::vector<double> resample(std::span<const double> samples, double from, double to)
+  {
+    // linear interpolation is plenty for a reverb tail
+    if (from == to || samples.empty()) {
+      return std::vector<double>(samples.begin(), samples.end());
+    }
+    std::vector<double> out(size_t(samples.size() * to / from));
+    for (size_t i = 0; i < out.size(); i++) {
+      double position = i * from / to;
+      size_t index = size_t(position);
+      double fraction = position - index;
+      double next = index + 1 < samples.size() ? samples[index + 1] : 0;
+      out[i] = samples[index] * (1 - fraction) + next * fraction;
+    }
+    return out;
+  }
+  std::vector<double> synthetic_room(double reverbTime, double sampleRate)
+  {
+    // exponentially decaying noise that is 60 dB down after reverbTime seconds, a decent stand-in for a diffuse room
+    std::mt19937 generator(1);
+    std::normal_distribution<double> noise;
+    std::vector<double> impulse(size_t(reverbTime * sampleRate));
+    double decay = log(1000) / (reverbTime * sampleRate);
+    for (size_t i = 1; i < impulse.size(); i++) {
+      impulse[i] = noise(generator) * exp(-decay * i);
+    }
+    return impulse;
+  }
+  void normalize(std::vector<double>& impulse)
+  {
+    // unit energy, so white noise comes out of the room exactly as loud as it went in
+    double energy = 0;
+    for (double x : impulse) {
+      energy += x * x;
+    }
+    if (energy > 0) {
+      for (double& x : impulse) {
+        x /= sqrt(energy);
+      }
+    }
+  }
+
+  // the voices themselves, rendered here instead of as oscillator + gain nodes when audio::activeBackend is engine
+  double sampleRate = 48000;
+  // everything is mixed 6 dB down before the limiter, so a few held notes never touch its ceiling
+  const double headroom = 0.5;
+  // partials nobody could hear are never started: above the top of human hearing, or above Nyquist if that is lower
+  const double hearingLimit = 20000;
+  // and voices are retired as soon as they decay below this, in dBFS at the output
+  double cullThreshold = -96;
+  struct cull_counters
+  {
+    long long aboveHearing = 0; // partials never started because of their frequency
+    long long belowThreshold = 0; // voices never started because they were too quiet to begin with
+    long long retired = 0; // voices that decayed below the threshold and were freed
+  };
+  cull_counters culled;
+  bool audible_frequency(double frequency)
+  {
+    return frequency < std::min(hearingLimit, sampleRate / 2);
+  }
+  double audible_time_constants(double amplitude)
+  {
+    // how long amplitude * e^-t/τ stays above the threshold after headroom, in time constants. 0 if it never is
+    return std::max(0.0, log(amplitude * headroom / pow(10, cullThreshold / 20)));
+  }
+  struct voice
+  {
+    size_t id;
+    long long startSample, endSample; // on the engine's sample clock, silent outside of [startSample, endSample)
+    // the output n samples after the start is amplitude * e^(-decay*n) * sin(omega*n)
+    double amplitude, decay, omega;
+    double stepRe, stepIm; // e^(-decay + i*omega), one sample of the recurrence
+    bool released; // stopped before it decayed away, so not counted as retired
+  };
+  std::optional<voice> make_voice(size_t id, double frequency, double amplitude, double timeConstant, long long startSample,
+                                  cull_counters& counters = culled)
+  {
+    // nothing if the voice was culled instead. runs on the ui side, which owns the threshold and the counters
+    if (!audible_frequency(frequency)) {
+      counters.aboveHearing++;
+      return std::nullopt;
+    }
+    double duration = audible_time_constants(amplitude) * timeConstant;
+    if (duration <= 0) {
+      counters.belowThreshold++;
+      return std::nullopt;
+    }
+    double decay = 1 / (timeConstant * sampleRate);
+    double omega = 2*pi*frequency / sampleRate;
+    return voice{id, startSample, startSample + (long long) (duration * sampleRate),
+                 amplitude, decay, omega, exp(-decay) * cos(omega), exp(-decay) * sin(omega), false};
+  }
+  // more voices than the page can sound at once, sequencer included. the live mix reserves this many up front
+  const size_t maxVoices = 1024;
+  void start_voice(std::vector<voice>& voices, const voice& v)
+  {
+    // restarts the voice if it is already sounding. once there are maxVoices, the one closest to its end makes room
+    // instead of the vector growing
+    for (voice& existing : voices) {
+      if (existing.id == v.id) {
+        existing = v;
+        return;
+      }
+    }
+    if (voices.size() >= maxVoices) {
+      *std::min_element(voices.begin(), voices.end(), [](const voice& a, const voice& b) {
+        return a.endSample < b.endSample;
+      }) = v;
+      return;
+    }
+    voices.emplace_back(v);
+  }
+  void stop_voice(std::vector<voice>& voices, size_t id, long long sample)
+  {
+    for (voice& v : voices) {
+      if (v.id == id && sample < v.endSample) {
+        v.endSample = sample;
+        v.released = true;
+      }
+    }
+  }
+
+  // the voice kernel runs in double or in float. float halves the width of every sample, so twice as many fit in a
+  // 128-bit wasm simd register. the default can be set at build time with -DANASYNTH_FLOAT32_ENGINE
+  enum class precision { float64, float32 };
+#ifdef ANASYNTH_FLOAT32_ENGINE
+  precision renderPrecision = precision::float32;
+#else
+  precision renderPrecision = precision::float64;
+#endif
+  template<typename T>
+  void render_voice(const voice& v, long long elapsed, std::span<T> out)
+  {
+    // adds out.size() samples of v into out, the first one elapsed samples after the voice started.
+    // every sample is one complex multiply of the phasor amplitude * e^((-decay + i*omega)n) instead of an exp and a sin,
+    // and the phasor is derived from scratch in double on every call, so rounding in the recurrence can only build up
+    // over one block. that keeps long held float notes in tune and at the right level
+    double magnitude = v.amplitude * fastmath::exp(-v.decay * elapsed);
+    double startRe = magnitude * fastmath::cos(v.omega * elapsed), startIm = magnitude * fastmath::sin(v.omega * elapsed);
+    // voices are vectorized across time rather than across voices, so every lane adds straight into its own output
+    // sample and no horizontal sums are needed
+    constexpr int lanes = 16 / sizeof(T);
+    typedef T lane_vector __attribute__((vector_size(16)));
+    size_t n = 0;
+    T re = startRe, im = startIm;
+    if (out.size() >= lanes) {
+      // lane k holds the phasor k samples ahead, and every step moves all of them lanes samples forward
+      lane_vector laneRe, laneIm;
+      double powerRe = 1, powerIm = 0;
+      for (int k = 0; k < lanes; k++) {
+        laneRe[k] = startRe * powerRe - startIm * powerIm;
+        laneIm[k] = startRe * powerIm + startIm * powerRe;
+        double nextRe = powerRe * v.stepRe - powerIm * v.stepIm;
+        powerIm = powerRe * v.stepIm + powerIm * v.stepRe;
+        powerRe = nextRe;
+      }
+      // after the loop power is step^lanes
+      T stepRe = powerRe, stepIm = powerIm;
+      for (; n + lanes <= out.size(); n += lanes) {
+        lane_vector sum;
+        __builtin_memcpy(&sum, &out[n], sizeof(sum));
+        sum += laneIm;
+        __builtin_memcpy(&out[n], &sum, sizeof(sum));
+        lane_vector nextRe = laneRe * stepRe - laneIm * stepIm;
+        laneIm = laneRe * stepIm + laneIm * stepRe;
+        laneRe = nextRe;
+      }
+      re = laneRe[0];
+      im = laneIm[0];
+    }
+    T stepRe = v.stepRe, stepIm = v.stepIm;
+    for (; n < out.size(); n++) {
+      out[n] += im;
+      T nextRe = re * stepRe - im * stepIm;
+      im = re * stepIm + im * stepRe;
+      re = nextRe;
+    }
+  }
+  template<typename T>
+  int render_voices(std::vector<voice>& voices, long long blockStart, std::span<T> block)
+  {
+    // adds every voice that sounds during [blockStart, blockStart + block.size()) into block, then retires the finished ones.
+    // returns how many of them decayed away rather than being stopped
+    long long blockEnd = blockStart + block.size();
+    for (const voice& v : voices) {
+      long long from = std::max(v.startSample, blockStart);
+      long long to = std::min(v.endSample, blockEnd);
+      if (from < to) {
+        render_voice<T>(v, from - v.startSample, block.subspan(from - blockStart, to - from));
+      }
+    }
+    int retired = 0;
+    std::erase_if(voices, [blockEnd, &retired](const voice& v) {
+      if (v.endSample > blockEnd) {
+        return false;
+      }
+      retired += !v.released;
+      return true;
+    });
+    return retired;
+  }
+  std::string accuracy_report(double seconds)
+  {
+    // renders the same voices in both precisions and compares them, without touching the live voices or counters.
+    // a low note held for the whole time is the worst case for drift, a sawtooth chord is the usual load
+    cull_counters counters;
+    std::vector<voice> reference;
+    auto add = [&reference](std::optional<voice> v) {
+      if (v) {
+        start_voice(reference, v.value());
+      }
+    };
+    for (int harmonic = 1; harmonic <= 10; harmonic++) {
+      add(make_voice(harmonic, 261.63 * harmonic, 0.5 / harmonic, 2, 0, counters));
+      add(make_voice(100 + harmonic, 329.63 * harmonic, 0.5 / harmonic, 2, sampleRate / 2, counters));
+    }
+    add(make_voice(0, 27.5, 0.5, seconds, 0, counters));
+    std::vector<voice> reduced = reference;
+    const size_t blockSize = 1024;
+    std::vector<double> doubleBlock(blockSize);
+    std::vector<float> singleBlock(blockSize);
+    double worst = 0, errorEnergy = 0, signalEnergy = 0;
+    long long samples = seconds * sampleRate;
+    for (long long start = 0; start < samples; start += blockSize) {
+      std::fill(doubleBlock.begin(), doubleBlock.end(), 0);
+      std::fill(singleBlock.begin(), singleBlock.end(), 0);
+      render_voices<double>(reference, start, doubleBlock);
+      render_voices<float>(reduced, start, singleBlock);
+      for (size_t i = 0; i < blockSize; i++) {
+        double error = singleBlock[i] - doubleBlock[i];
+        worst = std::max(worst, std::abs(error));
+        errorEnergy += error * error;
+        signalEnergy += doubleBlock[i] * doubleBlock[i];
+      }
+    }
+    std::ostringstream out;
+    out << std::setprecision(3) << "float32 against float64 over " << seconds << " s: max error " << 20 * log10(worst)
+        << " dBFS, error " << 10 * log10(errorEnergy / signalEnergy) << " dB below the signal\n";
+    return out.str();
+  }
+
+  struct biquad_section
+  {
+    double b0, b1, b2, a1, a2;
+    double z1 = 0, z2 = 0; // transposed direct form II state
+  };
+  void filter(std::vector<biquad_section>& sections, std::span<double> block)
+  {
+    for (biquad_section& s : sections) {
+      for (double& x : block) {
+        double y = s.b0 * x + s.z1;
+        s.z1 = s.b1 * x - s.a1 * y + s.z2;
+        s.z2 = s.b2 * x - s.a2 * y;
+        x = y;
+      }
+    }
+  }
+
+  struct lookahead_limiter
+  {
+    // the gain at every output sample is the boxcar average of a held minimum of the gains the next lookahead input
+    // samples need, so it is already all the way down when a peak comes out of the delay line and never overshoots.
+    // the hold is also smoothed by an exponential release so it does not pump
+    int lookahead;
+    double ceiling;
+    double release; // per-sample recovery towards 1
+    std::vector<double> delay; // lookahead - 1 samples of input
+    std::vector<double> averaged; // the last lookahead held gains
+    double averageSum;
+    // monotonic ring of (index, required gain) holding the minimum of the last lookahead required gains
+    std::vector<std::pair<long long, double>> minimum;
+    size_t minimumFront = 0, minimumSize = 0;
+    double held = 1;
+    long long position = 0;
+  };
+  lookahead_limiter make_limiter(int lookahead, double ceiling, double releaseTime)
+  {
+    return {lookahead, ceiling, 1 - exp(-1 / (releaseTime * sampleRate)), std::vector<double>(lookahead - 1, 0),
+            std::vector<double>(lookahead, 1), double(lookahead), std::vector<std::pair<long long, double>>(lookahead)};
+  }
+  void limit(lookahead_limiter& l, std::span<double> block)
+  {
+    size_t capacity = l.minimum.size();
+    for (double& x : block) {
+      double required = std::abs(x) > l.ceiling ? l.ceiling / std::abs(x) : 1;
+      // forget what fell out of the window, then push the new requirement over everything it is smaller than
+      if (l.minimumSize > 0 && l.minimum[l.minimumFront].first <= l.position - l.lookahead) {
+        l.minimumFront = (l.minimumFront + 1) % capacity;
+        l.minimumSize--;
+      }
+      while (l.minimumSize > 0 && l.minimum[(l.minimumFront + l.minimumSize - 1) % capacity].second >= required) {
+        l.minimumSize--;
+      }
+      l.minimum[(l.minimumFront + l.minimumSize) % capacity] = {l.position, required};
+      l.minimumSize++;
+      l.held = std::min(l.minimum[l.minimumFront].second, l.held + (1 - l.held) * l.release);
+      size_t slot = l.position % l.lookahead;
+      l.averageSum += l.held - l.averaged[slot];
+      l.averaged[slot] = l.held;
+      double gain = std::min(1.0, l.averageSum / l.lookahead);
+      double delayed = x;
+      if (!l.delay.empty()) {
+        size_t delaySlot = l.position % l.delay.size();
+        delayed = l.delay[delaySlot];
+        l.delay[delaySlot] = x;
+      }
+      x = delayed * gain;
+      l.position++;
+    }
+  }
+  // the mix is limited to -1 dBFS, so a big chord is squashed instead of clipped. 64 samples is 1.3 ms of latency at 48 kHz
+  const int limiterLookahead = 64;
+
+  // at 48 kHz a 256 sample partition keeps the per-block work small and even, and divides the processor buffer evenly
+  const size_t partitionSize = 256;
+  double roomWet = 0.3; // what the ui last asked for, the renderer keeps its own copy
+  std::optional<wav> roomFile;
+
+  template<typename T, size_t capacity>
+  struct spsc_ring
+  {
+    // wait-free ring between exactly one producer and one consumer thread. neither side ever locks or allocates:
+    // a full ring refuses the push and an empty one the pop. the indices only grow, so full is tail - head == capacity
+    static_assert(std::has_single_bit(capacity));
+    std::array<T, capacity> slots;
+    alignas(64) std::atomic<size_t> head = 0; // next slot to pop, only written by the consumer
+    alignas(64) std::atomic<size_t> tail = 0; // next slot to push, only written by the producer
+  };
+  template<typename T, size_t capacity>
+  bool push(spsc_ring<T, capacity>& ring, const T& value)
+  {
+    size_t tail = ring.tail.load(std::memory_order_relaxed);
+    // acquire pairs with the consumer's release, so the slot is not overwritten while it is still being read
+    if (tail - ring.head.load(std::memory_order_acquire) == capacity) {
+      return false;
+    }
+    ring.slots[tail % capacity] = value;
+    ring.tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+  template<typename T, size_t capacity>
+  bool pop(spsc_ring<T, capacity>& ring, T& value)
+  {
+    size_t head = ring.head.load(std::memory_order_relaxed);
+    if (head == ring.tail.load(std::memory_order_acquire)) {
+      return false;
+    }
+    value = ring.slots[head % capacity];
+    ring.head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+  template<typename T, size_t capacity>
+  size_t free_slots(const spsc_ring<T, capacity>& ring)
+  {
+    // only exact on the producer side, where the consumer can only make it grow in the meantime
+    return capacity - (ring.tail.load(std::memory_order_relaxed) - ring.head.load(std::memory_order_acquire));
+  }
+  // the same for a run of values at once, with one release for all of them. both return how many fit or were there
+  template<typename T, size_t capacity>
+  size_t push_many(spsc_ring<T, capacity>& ring, std::span<const T> values)
+  {
+    size_t tail = ring.tail.load(std::memory_order_relaxed);
+    size_t count = std::min(values.size(), capacity - (tail - ring.head.load(std::memory_order_acquire)));
+    for (size_t i = 0; i < count; i++) {
+      ring.slots[(tail + i) % capacity] = values[i];
+    }
+    ring.tail.store(tail + count, std::memory_order_release);
+    return count;
+  }
+  template<typename T, size_t capacity>
+  size_t pop_many(spsc_ring<T, capacity>& ring, std::span<T> values)
+  {
+    size_t head = ring.head.load(std::memory_order_relaxed);
+    size_t count = std::min(values.size(), ring.tail.load(std::memory_order_acquire) - head);
+    for (size_t i = 0; i < count; i++) {
+      values[i] = ring.slots[(head + i) % capacity];
+    }
+    ring.head.store(head + count, std::memory_order_release);
+    return count;
+  }
+
+  // the step sequencer and arpeggiator. its clock is the sample count inside render, so the steps land on exact samples
+  // of the rendered stream and never drift. that is only as steady as the buffers themselves: on the page process runs
+  // in a ScriptProcessorNode on the main thread, so a stall there delays or drops whole buffers, beat included.
+  // every step plays one key of the keyboard the ui hands over
+  const int maxSteps = 16;
+  struct pattern
+  {
+    enum class order { steps, up, down, up_down }; // the keys in keys, or the held keys arpeggiated
+    order play = order::steps;
+    double tempo = 120; // beats per minute
+    int stepsPerBeat = 4;
+    int length = 8; // steps before it repeats, up to maxSteps
+    std::array<int8_t, maxSteps> keys = {0, 4, 7, 12, 7, 4, 0, -1}; // order::steps: the key of every step, -1 rests
+    double gate = 0.5; // how much of its step a note is held
+    int partials = 1; // 1 for a sine, 10 for a sawtooth
+    bool operator==(const pattern&) const = default;
+  };
+  // the partials of every key, in order of their harmonic, as voices starting at sample 0
+  using keyboard = std::vector<std::vector<voice>>;
+  struct sequencer
+  {
+    pattern steps;
+    bool running = false;
+    uint32_t held = 0; // keys held down, bit n for key n
+    // step n starts at origin + n * step_length. the position is rounded per step, never accumulated, so it cannot drift
+    double origin = 0;
+    long long step = 0;
+    long long position = 0; // steps played since the transport started
+    size_t nextId = 0;
+  };
+  // ids of sequenced voices, out of the way of the ui's
+  const size_t sequencedVoice = size_t(1) << (8 * sizeof(size_t) - 1);
+
+  // what a mixer renders into, sized and built ahead so the renderer does not allocate: room for maxVoices voices,
+  // blocks of up to blockSize samples and the limiter, which needs the sample rate
+  struct mixer_buffers
+  {
+    std::vector<voice> voices;
+    std::vector<double> voiceBlock;
+    std::vector<float> floatBlock;
+    std::optional<lookahead_limiter> limiter;
+  };
+  std::unique_ptr<mixer_buffers> make_buffers(size_t blockSize)
+  {
+    auto b = std::make_unique<mixer_buffers>();
+    b->voices.reserve(maxVoices);
+    b->voiceBlock.resize(blockSize);
+    b->floatBlock.resize(blockSize);
+    b->limiter = make_limiter(limiterLookahead, pow(10, -1.0 / 20), 0.08);
+    return b;
+  }
+
+  // everything the ui tells the renderer goes through commands, and everything the renderer tells the ui through
+  // telemetry. both are plain fixed-size structs, and anything big (a room, a filter cascade) is built on the ui side
+  // and handed over by pointer, then handed back for the ui to free so the renderer never touches the heap for it
+  struct command
+  {
+    enum class kind { start_voice, stop_voice, stop_all_voices, set_precision, set_room, set_room_wet, set_speaker,
+                      set_pattern, transport, hold_keys, set_keyboard, set_buffers };
+    kind type;
+    voice started; // start_voice
+    size_t id; // stop_voice
+    long long sample; // stop_voice
+    precision renderPrecision; // set_precision
+    double wet; // set_room_wet
+    partitioned_convolver* room; // set_room, null for no room
+    std::vector<biquad_section>* sections; // set_speaker
+    pattern sequence; // set_pattern
+    bool run; // transport, which starts at sample or right away if that has passed
+    uint32_t held; // hold_keys
+    keyboard* keys; // set_keyboard
+    mixer_buffers* buffers; // set_buffers
+  };
+  struct telemetry
+  {
+    enum class kind { block, free_room, free_sections, free_keyboard, free_buffers };
+    kind type;
+    // block: where the clock is after the block, the voices left sounding and how many have decayed away so far
+    long long sample;
+    int voices;
+    long long retired;
+    partitioned_convolver* room; // free_room
+    std::vector<biquad_section>* sections; // free_sections
+    keyboard* keys = nullptr; // free_keyboard
+    long long steps = 0; // block: steps the sequencer has played since it started
+    mixer_buffers* buffers = nullptr; // free_buffers
+  };
+  // 1024 commands is more than a whole keyboard's worth of partials per audio callback
+  spsc_ring<command, 1024> commands;
+  spsc_ring<telemetry, 256> reports;
+  // block reports leave this many slots free, so hand-backs still fit while the ui is not polling
+  const size_t handBackSlots = 16;
+  // the final output, for the ui to look at. only filled while tapOutput is set, and what does not fit is dropped
+  spsc_ring<double, 32768> output;
+  std::atomic<bool> tapOutput = false;
+
+  // one independent mix: the voices, everything they go through and the clock. the page has exactly one, live, which
+  // only the thread running process touches. AnaSynthRender makes one per file
+  struct mixer
+  {
+    std::vector<voice> voices;
+    precision renderPrecision;
+    double roomWet;
+    std::unique_ptr<partitioned_convolver> room;
+    // the same cascade audio::set_speaker_stage builds out of IIR filter nodes, for the voices rendered here
+    std::unique_ptr<std::vector<biquad_section>> speakerSections;
+    std::optional<lookahead_limiter> limiter; // from swap_buffers, or made on the first block of an unprepared mixer
+    long long currentSample = 0; // engine sample index of the first sample of the next block
+    long long retiredVoices = 0;
+    std::vector<double> wetBlock = std::vector<double>(partitionSize);
+    std::vector<double> voiceBlock; // only the first block.size() samples are used
+    std::vector<float> floatBlock;
+    sequencer sequence;
+    std::unique_ptr<keyboard> keys;
+  };
+  double step_length(const pattern& p)
+  {
+    // in samples, not rounded
+    return 60 * sampleRate / (p.tempo * p.stepsPerBeat);
+  }
+  int next_key(const sequencer& s)
+  {
+    if (s.steps.play == pattern::order::steps) {
+      return s.steps.keys[s.position % s.steps.length];
+    }
+    std::array<int, 32> held;
+    int count = 0;
+    for (int key = 0; key < 32; key++) {
+      if (s.held >> key & 1) {
+        held[count++] = key;
+      }
+    }
+    if (count == 0) {
+      return -1;
+    }
+    switch (s.steps.play) {
+      case pattern::order::down:
+        return held[count - 1 - s.position % count];
+      case pattern::order::up_down: {
+        // the top and bottom keys are not repeated on the turn
+        long long period = std::max(1, 2 * (count - 1));
+        long long i = s.position % period;
+        return held[i < count ? i : period - i];
+      }
+      default:
+        return held[s.position % count];
+    }
+  }
+  void sequence(mixer& m, long long blockEnd)
+  {
+    // starts the voices of every step that begins before blockEnd, each at its exact sample
+    sequencer& s = m.sequence;
+    if (!s.running) {
+      return;
+    }
+    double length = step_length(s.steps);
+    for (long long start = llround(s.origin + s.step * length); start < blockEnd; start = llround(s.origin + s.step * length)) {
+      int key = next_key(s);
+      s.step++;
+      s.position++;
+      if (key < 0 || !m.keys || key >= int(m.keys->size())) {
+        continue;
+      }
+      const std::vector<voice>& partials = (*m.keys)[key];
+      long long end = start + std::max(1LL, llround(s.steps.gate * length));
+      for (int partial = 0; partial < std::min<int>(s.steps.partials, partials.size()); partial++) {
+        voice v = partials[partial];
+        v.id = sequencedVoice | s.nextId++;
+        v.startSample += start;
+        v.endSample += start;
+        v.released = end < v.endSample;
+        v.endSample = std::min(v.endSample, end);
+        start_voice(m.voices, v);
+      }
+    }
+  }
+  void render(mixer& m, std::span<double> block)
+  {
+    // in place: block comes in holding whatever is mixed in from outside and leaves holding the final output.
+    // block is a multiple of partitionSize and starts at m.currentSample
+    sequence(m, m.currentSample + block.size());
+    if (m.voiceBlock.size() < block.size()) {
+      // only a mixer that was never given buffers for blocks this big, like AnaSynthRender's per file ones, gets here
+      m.voiceBlock.resize(block.size());
+      m.floatBlock.resize(block.size());
+    }
+    std::span<double> voiceBlock(m.voiceBlock.data(), block.size());
+    std::fill(voiceBlock.begin(), voiceBlock.end(), 0);
+    if (m.renderPrecision == precision::float32) {
+      std::span<float> floatBlock(m.floatBlock.data(), block.size());
+      std::fill(floatBlock.begin(), floatBlock.end(), 0);
+      m.retiredVoices += render_voices<float>(m.voices, m.currentSample, floatBlock);
+      for (size_t i = 0; i < block.size(); i++) {
+        voiceBlock[i] += floatBlock[i];
+      }
+    } else {
+      m.retiredVoices += render_voices<double>(m.voices, m.currentSample, voiceBlock);
+    }
+    if (m.speakerSections) {
+      filter(*m.speakerSections, voiceBlock);
+    }
+    for (size_t i = 0; i < block.size(); i++) {
+      block[i] += headroom * voiceBlock[i];
+    }
+    if (m.room) {
+      for (size_t start = 0; start + partitionSize <= block.size(); start += partitionSize) {
+        std::span<double> part = block.subspan(start, partitionSize);
+        convolve_block(*m.room, part, m.wetBlock);
+        for (size_t i = 0; i < partitionSize; i++) {
+          part[i] = (1 - m.roomWet) * part[i] + m.roomWet * m.wetBlock[i];
+        }
+      }
+    }
+    if (!m.limiter) {
+      m.limiter = make_limiter(limiterLookahead, pow(10, -1.0 / 20), 0.08);
+    }
+    limit(m.limiter.value(), block);
+    m.currentSample += block.size();
+  }
+
+  mixer live = {{}, renderPrecision, roomWet};
+  void swap_buffers(mixer& m, mixer_buffers& b)
+  {
+    // m takes the buffers and b ends up with the old ones. the voices are copied over first, and fit, since start_voice
+    // never lets there be more than maxVoices. the limiter is only taken when m has none yet, replacing a running one
+    // would cut off what is in its delay line
+    b.voices.assign(m.voices.begin(), m.voices.end());
+    std::swap(m.voices, b.voices);
+    std::swap(m.voiceBlock, b.voiceBlock);
+    std::swap(m.floatBlock, b.floatBlock);
+    if (!m.limiter) {
+      std::swap(m.limiter, b.limiter);
+    }
+  }
+  void hand_back(telemetry t)
+  {
+    // always fits, apply_commands only takes a command while there is room for what it hands back
+    push(reports, t);
+  }
+  void apply_commands()
+  {
+    // a command hands back at most one thing, so with the reports full the rest wait in the queue for the next block
+    // rather than the renderer freeing anything itself
+    command c;
+    while (free_slots(reports) > 0 && pop(commands, c)) {
+      switch (c.type) {
+        case command::kind::start_voice:
+          start_voice(live.voices, c.started);
+          break;
+        case command::kind::stop_voice:
+          stop_voice(live.voices, c.id, c.sample);
+          break;
+        case command::kind::stop_all_voices:
+          // clear keeps the capacity, so this never frees
+          live.voices.clear();
+          break;
+        case command::kind::set_precision:
+          live.renderPrecision = c.renderPrecision;
+          break;
+        case command::kind::set_room:
+          if (live.room) {
+            hand_back({telemetry::kind::free_room, 0, 0, 0, live.room.release(), nullptr});
+          }
+          live.room.reset(c.room);
+          break;
+        case command::kind::set_room_wet:
+          live.roomWet = c.wet;
+          break;
+        case command::kind::set_speaker:
+          if (live.speakerSections) {
+            hand_back({telemetry::kind::free_sections, 0, 0, 0, nullptr, live.speakerSections.release()});
+          }
+          live.speakerSections.reset(c.sections);
+          break;
+        case command::kind::set_pattern: {
+          // a new tempo takes over from the next step on
+          sequencer& s = live.sequence;
+          s.origin = llround(s.origin + s.step * step_length(s.steps));
+          s.step = 0;
+          s.steps = c.sequence;
+          break;
+        }
+        case command::kind::transport:
+          live.sequence.running = c.run;
+          live.sequence.origin = std::max(c.sample, live.currentSample);
+          live.sequence.step = 0;
+          live.sequence.position = 0;
+          break;
+        case command::kind::hold_keys:
+          live.sequence.held = c.held;
+          break;
+        case command::kind::set_buffers:
+          swap_buffers(live, *c.buffers);
+          hand_back({.type = telemetry::kind::free_buffers, .buffers = c.buffers});
+          break;
+        case command::kind::set_keyboard:
+          if (live.keys) {
+            hand_back({telemetry::kind::free_keyboard, 0, 0, 0, nullptr, nullptr, live.keys.release()});
+          }
+          live.keys.reset(c.keys);
+          break;
+      }
+    }
+  }
+  void process(std::span<double> block)
+  {
+    // the page's engine: block comes in holding the Web Audio mix
+    apply_commands();
+    render(live, block);
+    if (tapOutput.load(std::memory_order_relaxed)) {
+      push_many(output, std::span<const double>(block));
+    }
+    // the counters are running totals, so a report dropped on a full queue loses nothing but one update
+    if (free_slots(reports) > handBackSlots) {
+      push(reports, {telemetry::kind::block, live.currentSample, int(live.voices.size()), live.retiredVoices, nullptr,
+                     nullptr, nullptr, live.sequence.position});
+    }
+  }
+
+  // what the renderer last reported, on the ui side
+  telemetry reported = {telemetry::kind::block, 0, 0, 0, nullptr, nullptr};
+  void poll_telemetry()
+  {
+    telemetry t;
+    while (pop(reports, t)) {
+      switch (t.type) {
+        case telemetry::kind::block:
+          reported = t;
+          break;
+        case telemetry::kind::free_room:
+          delete t.room;
+          break;
+        case telemetry::kind::free_sections:
+          delete t.sections;
+          break;
+        case telemetry::kind::free_keyboard:
+          delete t.keys;
+          break;
+        case telemetry::kind::free_buffers:
+          delete t.buffers;
+          break;
+      }
+    }
+  }
+}
+
+namespace resynthesis
+{
+  // a recorded sound as the RLC circuits audio::add_rlcs takes. a short-time Fourier transform finds the spectral peaks
+  // of every frame, peaks are joined across frames into partials, and each partial is fitted with a damped sinusoid.
+  // frames are analyzed a chunk at a time, spread over the threads, so only one chunk of spectra exists at once. the
+  // samples themselves are all in memory: the page decodes the whole file with engine::parse_wav before this runs.
+  // nothing in here knows about the browser, tests/resynthesis_test.cpp runs it natively
+  using std::numbers::pi;
+  const size_t frameSize = 4096; // 85 ms at 48 kHz, about 12 Hz between bins
+  const int hop = 1024;
+  const int chunkFrames = 256;
+  const int maxPeaks = 48; // per frame, the loudest
+  const double peakFloor = 1e-4; // -80 dBFS, anything quieter is noise
+  const double maxDrift = 0.03; // a peak continues a partial if it is within 3% of its last frequency
+  const int minFrames = 3;
+  const double onset = 2; // a partial that jumps up this much was struck again, and is a new one from there
+
+  const int maxPartials = 64; // voices it ends up as, strongest first
+  struct peak
+  {
+    double frequency, amplitude;
+  };
+  struct partial
+  {
+    // one amplitude per frame from first on, 0 where it was not found
+    int first;
+    double frequency; // of the last peak, to match the next one to
+    std::vector<double> amplitudes;
+    int missed = 0;
+    double weightedFrequency = 0, weight = 0; // for the mean frequency, weighted by amplitude²
+    void add(int frame, const peak& p)
+    {
+      amplitudes.resize(frame - first + 1, 0);
+      amplitudes.back() = p.amplitude;
+      frequency = p.frequency;
+      weightedFrequency += p.frequency * p.amplitude * p.amplitude;
+      weight += p.amplitude * p.amplitude;
+      missed = 0;
+    }
+  };
+  struct result
+  {
+    std::vector<std::tuple<double, double, double>> rlcs; // frequency, initial volume, time constant
+    int frames = 0, partials = 0, threads = 1;
+    double seconds = 0, milliseconds = 0;
+  };
+  std::vector<double> hann()
+  {
+    std::vector<double> window(frameSize);
+    for (size_t i = 0; i < frameSize; i++) {
+      window[i] = 0.5 - 0.5 * cos(2*pi*i / frameSize);
+    }
+    return window;
+  }
+  struct scratch
+  {
+    std::vector<engine::complex> spectrum = std::vector<engine::complex>(frameSize);
+    std::array<std::vector<double>, 2> magnitudes = {std::vector<double>(frameSize / 2), std::vector<double>(frameSize / 2)};
+  };
+  void pick_peaks(const std::vector<double>& magnitude, double sampleRate, std::vector<peak>& peaks)
+  {
+    peaks.clear();
+    for (size_t k = 1; k + 1 < magnitude.size(); k++) {
+      double left = magnitude[k - 1], middle = magnitude[k], right = magnitude[k + 1];
+      if (middle > peakFloor && middle > left && middle >= right) {
+        // a parabola through the log magnitudes puts the peak between bins
+        double a = log(std::max(left, 1e-300)), b = log(middle), c = log(std::max(right, 1e-300));
+        double offset = 0.5 * (a - c) / (a - 2 * b + c);
+        peaks.push_back({(k + offset) * sampleRate / frameSize, exp(b - 0.25 * (a - c) * offset)});
+      }
+    }
+    if (peaks.size() > maxPeaks) {
+      std::nth_element(peaks.begin(), peaks.begin() + maxPeaks, peaks.end(), [](const peak& x, const peak& y) { return x.amplitude > y.amplitude; });
+      peaks.resize(maxPeaks);
+    }
+  }
+  void find_peaks(std::span<const double> samples, std::array<long long, 2> starts, const std::vector<double>& window,
+                  double sampleRate, scratch& s, std::array<std::vector<peak>*, 2> peaks)
+  {
+    // two frames in one FFT, one as the real part and one as the imaginary part, pulled apart by symmetry afterwards.
+    // frames are zero padded past the end of the file, and a missing second frame is all zeros
+    auto at = [&samples](long long i) { return i >= 0 && size_t(i) < samples.size() ? samples[i] : 0.0; };
+    for (size_t i = 0; i < frameSize; i++) {
+      s.spectrum[i] = engine::complex(at(starts[0] + i), starts[1] >= 0 ? at(starts[1] + i) : 0.0) * window[i];
+    }
+    engine::fft(s.spectrum, false);
+    for (size_t k = 0; k < frameSize / 2; k++) {
+      engine::complex z = s.spectrum[k], mirrored = std::conj(s.spectrum[(frameSize - k) % frameSize]);
+      // a sine of amplitude a peaks at a * frameSize / 4 through a Hann window
+      s.magnitudes[0][k] = std::abs(z + mirrored) / 2 * 4 / frameSize;
+      s.magnitudes[1][k] = std::abs(z - mirrored) / 2 * 4 / frameSize;
+    }
+    for (int j = 0; j < 2; j++) {
+      if (peaks[j]) {
+        pick_peaks(s.magnitudes[j], sampleRate, *peaks[j]);
+      }
+    }
+  }
+  void track(std::vector<peak>& peaks, int frame, std::vector<partial>& active, std::vector<partial>& finished)
+  {
+    // loudest peaks claim the nearest partial first, whatever is left over starts a new one
+    std::sort(peaks.begin(), peaks.end(), [](const peak& x, const peak& y) { return x.amplitude > y.amplitude; });
+    std::vector<bool> continued(active.size(), false);
+    for (const peak& p : peaks) {
+      int best = -1;
+      for (int i = 0; i < int(active.size()); i++) {
+        double drift = std::abs(p.frequency / active[i].frequency - 1);
+        if (!continued[i] && drift < maxDrift && (best < 0 || drift < std::abs(p.frequency / active[best].frequency - 1))) {
+          best = i;
+        }
+      }
+      if (best >= 0 && p.amplitude > onset * active[best].amplitudes.back() && active[best].amplitudes.back() > 0) {
+        finished.push_back(std::move(active[best]));
+        active[best] = {frame};
+        active[best].add(frame, p);
+        continued[best] = true;
+      } else if (best >= 0) {
+        active[best].add(frame, p);
+        continued[best] = true;
+      } else {
+        active.push_back({frame});
+        active.back().add(frame, p);
+        continued.push_back(true);
+      }
+    }
+    // a partial survives one frame without a peak, so a beat or a noisy frame does not split it
+    for (int i = 0; i < int(active.size()); i++) {
+      if (!continued[i]) {
+        active[i].missed++;
+      }
+    }
+    auto ended = std::stable_partition(active.begin(), active.end(), [](const partial& q) { return q.missed < 2; });
+    std::move(ended, active.end(), std::back_inserter(finished));
+    active.erase(ended, active.end());
+  }
+  std::optional<std::tuple<double, double, double>> fit(const partial& q, double sampleRate)
+  {
+    // least squares line through log amplitude over time, from the loudest frame on, weighted by amplitude² so the
+    // noise floor at the tail does not bend it. the voice starts at the loudest frame at the fitted amplitude
+    if (std::count_if(q.amplitudes.begin(), q.amplitudes.end(), [](double a) { return a > 0; }) < minFrames) {
+      return std::nullopt;
+    }
+    size_t loudest = std::max_element(q.amplitudes.begin(), q.amplitudes.end()) - q.amplitudes.begin();
+    double w = 0, wt = 0, wy = 0, wtt = 0, wty = 0;
+    for (size_t i = loudest; i < q.amplitudes.size(); i++) {
+      if (q.amplitudes[i] <= 0) {
+        continue;
+      }
+      double t = (i - loudest) * hop / sampleRate, y = log(q.amplitudes[i]), weight = q.amplitudes[i] * q.amplitudes[i];
+      w += weight;
+      wt += weight * t;
+      wy += weight * y;
+      wtt += weight * t * t;
+      wty += weight * t * y;
+    }
+    double spread = w * wtt - wt * wt;
+    double slope = spread > 0 ? (w * wty - wt * wy) / spread : 0;
+    double intercept = (wy - slope * wt) / w;
+    // one that does not decay rings as long as it was heard
+    double heard = (q.amplitudes.size() - loudest) * hop / sampleRate;
+    double timeConstant = slope < 0 ? std::min(-1 / slope, 30.0) : std::max(heard, 0.05);
+    return std::make_tuple(q.weightedFrequency / q.weight, exp(intercept), timeConstant);
+  }
+  result analyze(std::span<const double> samples, double sampleRate)
+  {
+    auto started = std::chrono::steady_clock::now();
+    result r;
+    r.threads = engine::thread_count();
+    r.frames = (samples.size() + hop - 1) / hop;
+    r.seconds = samples.size() / sampleRate;
+    std::vector<double> window = hann();
+    std::vector<std::vector<peak>> chunk(chunkFrames);
+    std::vector<scratch> scratches(r.threads);
+    std::vector<partial> active, finished;
+    for (int first = 0; first < r.frames; first += chunkFrames) {
+      int count = std::min(chunkFrames, r.frames - first);
+      // the frames are independent, only the tracking has to see them in order. they are handed out in pairs
+      int pairs = (count + 1) / 2;
+      engine::parallel_for(pairs, std::min(r.threads, pairs), [&](int begin, int end, int thread) {
+        for (int pair = begin; pair < end; pair++) {
+          int i = 2 * pair;
+          bool second = i + 1 < count;
+          find_peaks(samples, {(long long) (first + i) * hop, second ? (long long) (first + i + 1) * hop : -1}, window,
+                     sampleRate, scratches[thread], {&chunk[i], second ? &chunk[i + 1] : nullptr});
+        }
+      });
+      for (int i = 0; i < count; i++) {
+        track(chunk[i], first + i, active, finished);
+      }
+    }
+    std::move(active.begin(), active.end(), std::back_inserter(finished));
+    for (const partial& q : finished) {
+      if (std::optional<std::tuple<double, double, double>> rlc = fit(q, sampleRate)) {
+        r.rlcs.push_back(rlc.value());
+      }
+    }
+    // every voice starts at once when played, so a partial that comes back later is the same circuit: only the
+    // strongest at each frequency is kept, by how much it sounds in total (amplitude² τ)
+    auto energy = [](const std::tuple<double, double, double>& rlc) {
+      auto [frequency, amplitude, timeConstant] = rlc;
+      return amplitude * amplitude * timeConstant;
+    };
+    std::sort(r.rlcs.begin(), r.rlcs.end(), [&energy](auto& x, auto& y) { return energy(x) > energy(y); });
+    std::vector<std::tuple<double, double, double>> kept;
+    for (auto& rlc : r.rlcs) {
+      bool duplicate = std::any_of(kept.begin(), kept.end(), [&rlc](auto& k) { return std::abs(std::get<0>(rlc) / std::get<0>(k) - 1) < maxDrift; });
+      if (!duplicate && kept.size() < maxPartials) {
+        kept.push_back(rlc);
+      }
+    }
+    r.partials = finished.size();
+    r.rlcs = std::move(kept);
+    r.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+    return r;
+  }
+}
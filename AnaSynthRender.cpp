@@ -0,0 +1,483 @@
+// renders every score in a directory to a WAV file natively, with the same engine the page plays through, spread over
+// all the cores. made for rendering libraries of example tones for course material.
+//
+//   AnaSynthRender <score directory> <output directory> [--threads n] [--rate hz] [--float32]
+//
+// a score is a text file ending in .score with one command per line, # starts a comment:
+//   note <start s> <frequency Hz> <amplitude> <time constant s> [<release s>]  one RLC circuit, like a sine key
+//   saw <start s> <frequency Hz> <amplitude> <time constant s> [<release s>]   10 of them at amplitude/n, like page 10
+//   room none|small|hall [<wet 0-1>]
+// amplitudes are full scale before the engine's 6 dB of headroom, and a voice without a release rings until it is
+// below the cull threshold. the file ends once everything, room tail included, has died away
+//
+//   AnaSynthRender --stream [<score>] [--output path] [--format f32|s16] [--channels 1-8] [--block n] [--realtime]
+//
+// streams raw PCM to stdout or a file or named pipe instead, block by block, for piping into ffmpeg, sox, aplay and the
+// like. with a score it plays that and stops, without one it plays score lines as they arrive on stdin, their start
+// counted from when they are read, plus stop and quit. it goes as fast as the reader takes it, or at playback speed
+// with --realtime, and ends once stdin does and everything has died away
+
+#include "AnaSynthEngine.h"
+
+#include <iostream>
+#include <fstream>
+#include <csignal>
+#include <cstdio>
+#include <filesystem>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <string>
+#include <charconv>
+
+namespace batch
+{
+  struct score
+  {
+    std::filesystem::path path;
+    std::vector<engine::voice> voices;
+    std::string room = "none";
+    double roomWet = engine::roomWet;
+    long long length = 0; // samples, up to the end of the last voice
+    size_t nextId = 0;
+  };
+  // one score line into s, with its times counted from origin. false with error set if the line is not understood
+  bool parse_line(const std::string& line, long long origin, score& s, engine::cull_counters& counters, std::string& error)
+  {
+    std::istringstream fields(line.substr(0, line.find('#')));
+    std::string command;
+    if (!(fields >> command)) {
+      return true;
+    }
+    if (command == "note" || command == "saw") {
+      double start, frequency, amplitude, timeConstant, release = -1;
+      if (!(fields >> start >> frequency >> amplitude >> timeConstant) || start < 0 || timeConstant <= 0) {
+        error = "expected <start> <frequency> <amplitude> <time constant> [<release>]";
+        return false;
+      }
+      fields >> release;
+      long long startSample = origin + llround(start * engine::sampleRate);
+      int harmonics = command == "saw" ? 10 : 1;
+      for (int harmonic = 1; harmonic <= harmonics; harmonic++) {
+        std::optional<engine::voice> v = engine::make_voice(s.nextId++, frequency * harmonic, amplitude / harmonic,
+                                                            timeConstant, startSample, counters);
+        if (!v) {
+          continue;
+        }
+        if (release >= 0) {
+          v->endSample = std::min(v->endSample, startSample + llround(release * engine::sampleRate));
+        }
+        s.length = std::max(s.length, v->endSample);
+        s.voices.push_back(v.value());
+      }
+    } else if (command == "room") {
+      fields >> s.room >> s.roomWet;
+      if (s.room != "none" && s.room != "small" && s.room != "hall") {
+        error = "the room is none, small or hall";
+        return false;
+      }
+    } else {
+      error = "unknown command " + command;
+      return false;
+    }
+    return true;
+  }
+  std::optional<score> parse_score(const std::filesystem::path& path, std::string& error)
+  {
+    std::ifstream file(path);
+    if (!file) {
+      error = "could not open it";
+      return std::nullopt;
+    }
+    score s{path};
+    engine::cull_counters counters;
+    std::string line;
+    for (int number = 1; std::getline(file, line); number++) {
+      if (!parse_line(line, 0, s, counters, error)) {
+        error = "line " + std::to_string(number) + ": " + error;
+        return std::nullopt;
+      }
+    }
+    return s;
+  }
+
+  // the room a score asks for, and how long its tail rings. null for none
+  std::unique_ptr<engine::partitioned_convolver> make_room(const std::string& name, long long& tail)
+  {
+    tail = 0;
+    if (name == "none") {
+      return nullptr;
+    }
+    std::vector<double> impulse = engine::synthetic_room(name == "small" ? 0.5 : 2.0, engine::sampleRate);
+    engine::normalize(impulse);
+    tail = impulse.size();
+    return std::make_unique<engine::partitioned_convolver>(engine::make_convolver(impulse, engine::partitionSize));
+  }
+
+  bool write_wav(const std::filesystem::path& path, std::span<const double> samples, double sampleRate)
+  {
+    // 16-bit mono PCM, everything little-endian. false if the file could not be opened or written in full
+    auto put = [](std::ofstream& out, uint32_t value, int bytes) {
+      for (int i = 0; i < bytes; i++) {
+        out.put(char((value >> (8 * i)) & 0xff));
+      }
+    };
+    std::ofstream out(path, std::ios::binary);
+    if (!out) {
+      return false;
+    }
+    uint32_t dataBytes = samples.size() * 2;
+    out.write("RIFF", 4);
+    put(out, 36 + dataBytes, 4);
+    out.write("WAVEfmt ", 8);
+    put(out, 16, 4);
+    put(out, 1, 2); // PCM
+    put(out, 1, 2); // channels
+    put(out, uint32_t(sampleRate), 4);
+    put(out, uint32_t(sampleRate) * 2, 4);
+    put(out, 2, 2);
+    put(out, 16, 2);
+    out.write("data", 4);
+    put(out, dataBytes, 4);
+    for (double x : samples) {
+      put(out, uint16_t(int16_t(lround(std::clamp(x, -1.0, 1.0) * 32767))), 2);
+    }
+    out.close();
+    return !out.fail();
+  }
+
+  std::atomic<long long> samplesRendered = 0;
+  // the workers count finished files under progress and wake the main thread with fileFinished. the last one records
+  // when it finished, so the throughput is not padded by however long the main thread takes to notice
+  std::mutex progress;
+  std::condition_variable fileFinished;
+  size_t filesDone = 0;
+  int filesUnwritten = 0;
+  std::chrono::steady_clock::time_point lastFinished;
+  void render(const score& s, engine::precision precision, const std::filesystem::path& output)
+  {
+    engine::mixer m = {s.voices, precision, s.roomWet};
+    long long tail;
+    m.room = make_room(s.room, tail);
+    // the limiter delays everything by its look-ahead
+    long long length = s.length + tail + engine::limiterLookahead;
+    std::vector<double> samples;
+    samples.reserve(length + engine::partitionSize);
+    std::vector<double> block(4 * engine::partitionSize);
+    while (samples.size() < size_t(length)) {
+      std::fill(block.begin(), block.end(), 0);
+      engine::render(m, block);
+      samples.insert(samples.end(), block.begin(), block.end());
+      samplesRendered += block.size();
+    }
+    samples.resize(length);
+    bool written = write_wav(output, samples, engine::sampleRate);
+    std::lock_guard<std::mutex> lock(progress);
+    if (!written) {
+      std::cerr << "\nError: could not write " << output.string() << "\n";
+      filesUnwritten++;
+    }
+    filesDone++;
+    lastFinished = std::chrono::steady_clock::now();
+    fileFinished.notify_one();
+  }
+}
+
+namespace stream
+{
+  // raw PCM, channels interleaved, in the machine's byte order
+  enum class format { f32, s16 };
+  struct options
+  {
+    std::string score; // empty for commands on stdin
+    std::string output; // empty for stdout
+    format sampleFormat = format::f32;
+    int channels = 1;
+    size_t blockSize = 1024; // samples per channel, a multiple of partitionSize
+    bool realtime = false;
+  };
+
+  // where the renderer is, for the reader to time its commands from
+  std::atomic<long long> clock = 0;
+  std::atomic<bool> inputDone = false;
+  void read_commands()
+  {
+    // the ui side of the engine: every stdin line is a score line with its start counted from the clock when it is
+    // read, plus stop (silence everything) and quit. a full command ring makes this wait, so a fast writer is held
+    // back instead of piling up notes
+    batch::score s;
+    engine::cull_counters counters;
+    std::string line, error;
+    auto send = [](const engine::command& c) {
+      // the renderer stops taking commands while the reports are full, so they are drained while waiting
+      while (!engine::push(engine::commands, c)) {
+        engine::poll_telemetry();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+    };
+    while (std::getline(std::cin, line)) {
+      engine::poll_telemetry();
+      std::istringstream fields(line);
+      std::string command;
+      fields >> command;
+      if (command == "quit") {
+        break;
+      }
+      if (command == "stop") {
+        send({.type = engine::command::kind::stop_all_voices});
+        continue;
+      }
+      std::string room = s.room;
+      double wet = s.roomWet;
+      if (!batch::parse_line(line, clock, s, counters, error)) {
+        std::cerr << "Error: " << error << "\n";
+        continue;
+      }
+      for (const engine::voice& v : s.voices) {
+        send({.type = engine::command::kind::start_voice, .started = v});
+      }
+      s.voices.clear();
+      if (s.room != room) {
+        long long tail;
+        send({.type = engine::command::kind::set_room, .room = batch::make_room(s.room, tail).release()});
+      }
+      if (s.roomWet != wet) {
+        send({.type = engine::command::kind::set_room_wet, .wet = s.roomWet});
+      }
+    }
+    inputDone = true;
+  }
+
+  int run(const options& o, engine::precision precision)
+  {
+    FILE* out = o.output.empty() ? stdout : std::fopen(o.output.c_str(), "wb"); // a named pipe waits here for its reader
+    if (!out) {
+      std::cerr << "Error: could not open " << o.output << "\n";
+      return 1;
+    }
+#ifdef SIGPIPE
+    // a reader going away shows up as a failed write instead of killing us
+    std::signal(SIGPIPE, SIG_IGN);
+#endif
+    engine::live.renderPrecision = precision;
+    // nothing else is running yet, so the buffers go straight in instead of through a set_buffers command
+    engine::swap_buffers(engine::live, *engine::make_buffers(o.blockSize));
+    // a score is known up front and ends, commands keep it going until stdin does
+    long long length = -1;
+    long long tail = 0;
+    if (!o.score.empty()) {
+      std::string error;
+      std::optional<batch::score> s = batch::parse_score(o.score, error);
+      if (!s) {
+        std::cerr << "Error: " << o.score << ": " << error << "\n";
+        return 1;
+      }
+      engine::live.voices = s->voices;
+      engine::live.roomWet = s->roomWet;
+      engine::live.room = batch::make_room(s->room, tail);
+      length = s->length + tail + engine::limiterLookahead;
+    } else {
+      std::thread(read_commands).detach();
+    }
+
+    // one block at a time, written out before the next is rendered. the write blocks while the pipe is full, so a slow
+    // reader slows the renderer down and nothing queues up in here
+    std::vector<double> block(o.blockSize);
+    std::vector<std::byte> bytes(o.blockSize * o.channels * (o.sampleFormat == format::f32 ? sizeof(float) : sizeof(int16_t)));
+    auto started = std::chrono::steady_clock::now();
+    while (length < 0 || engine::live.currentSample < length) {
+      if (length < 0 && inputDone) {
+        // stdin is finished: read the flag before draining, so every command sent before it is applied, then let the
+        // last voices and the room ring out. the reader is gone, so this thread frees what the renderer hands back, and
+        // reports still full afterwards mean commands are left for the next block
+        engine::poll_telemetry();
+        engine::apply_commands();
+        if (engine::live.voices.empty() && engine::free_slots(engine::reports) > 0) {
+          long long tail = engine::live.room ? engine::live.room->partitions.size() * engine::partitionSize : 0;
+          length = engine::live.currentSample + tail + engine::limiterLookahead;
+        }
+      }
+      std::fill(block.begin(), block.end(), 0);
+      engine::process(block);
+      clock = engine::live.currentSample;
+      size_t samples = length < 0 ? block.size() : std::min<long long>(block.size(), length - (engine::live.currentSample - block.size()));
+      for (size_t i = 0; i < samples; i++) {
+        double x = std::clamp(block[i], -1.0, 1.0);
+        for (int c = 0; c < o.channels; c++) {
+          if (o.sampleFormat == format::f32) {
+            reinterpret_cast<float*>(bytes.data())[i * o.channels + c] = float(x);
+          } else {
+            reinterpret_cast<int16_t*>(bytes.data())[i * o.channels + c] = int16_t(lround(x * 32767));
+          }
+        }
+      }
+      size_t size = samples * o.channels * (o.sampleFormat == format::f32 ? sizeof(float) : sizeof(int16_t));
+      if (std::fwrite(bytes.data(), 1, size, out) != size || std::fflush(out) != 0) {
+        std::cerr << "output closed after " << std::fixed << std::setprecision(1)
+                  << engine::live.currentSample / engine::sampleRate << " s\n";
+        return 0;
+      }
+      if (o.realtime) {
+        // never more than one block ahead of the wall clock, for readers that take whatever they are given
+        std::this_thread::sleep_until(started + std::chrono::duration<double>((engine::live.currentSample - block.size()) / engine::sampleRate));
+      }
+    }
+    if (out != stdout) {
+      std::fclose(out);
+    }
+    std::cerr << "streamed " << std::fixed << std::setprecision(1) << std::min(engine::live.currentSample, length) / engine::sampleRate
+              << " s of audio\n";
+    return 0;
+  }
+}
+
+namespace arguments
+{
+  // the numbers on the command line, nothing if the whole argument is not one or it is out of range, so a typo ends
+  // in the usage text instead of an exception or a division by zero
+  std::optional<int> integer(const std::string& text, int low, int high)
+  {
+    int value;
+    auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+    if (error != std::errc() || end != text.data() + text.size() || value < low || value > high) {
+      return std::nullopt;
+    }
+    return value;
+  }
+  std::optional<double> positive(const std::string& text)
+  {
+    double value;
+    auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+    if (error != std::errc() || end != text.data() + text.size() || !std::isfinite(value) || value <= 0) {
+      return std::nullopt;
+    }
+    return value;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  std::vector<std::string> args(argv + 1, argv + argc);
+  if (!args.empty() && args[0] == "--stream") {
+    stream::options o;
+    engine::precision precision = engine::precision::float64;
+    for (size_t i = 1; i < args.size(); i++) {
+      std::optional<int> number;
+      std::optional<double> rate;
+      if (args[i] == "--output" && i + 1 < args.size()) {
+        o.output = args[++i];
+      } else if (args[i] == "--format" && i + 1 < args.size() && (args[i + 1] == "f32" || args[i + 1] == "s16")) {
+        o.sampleFormat = args[++i] == "f32" ? stream::format::f32 : stream::format::s16;
+      } else if (args[i] == "--channels" && i + 1 < args.size() && (number = arguments::integer(args[i + 1], 1, 8))) {
+        o.channels = number.value();
+        i++;
+      } else if (args[i] == "--block" && i + 1 < args.size() && (number = arguments::integer(args[i + 1], 1, 1 << 20))) {
+        o.blockSize = (number.value() + engine::partitionSize - 1) / engine::partitionSize * engine::partitionSize;
+        i++;
+      } else if (args[i] == "--realtime") {
+        o.realtime = true;
+      } else if (args[i] == "--rate" && i + 1 < args.size() && (rate = arguments::positive(args[i + 1]))) {
+        engine::sampleRate = rate.value();
+        i++;
+      } else if (args[i] == "--float32") {
+        precision = engine::precision::float32;
+      } else if (o.score.empty() && args[i][0] != '-') {
+        o.score = args[i];
+      } else {
+        std::cerr << "usage: AnaSynthRender --stream [<score>] [--output path] [--format f32|s16] [--channels 1-8] "
+                     "[--block n] [--realtime] [--rate hz] [--float32]\n";
+        return 2;
+      }
+    }
+    return stream::run(o, precision);
+  }
+  std::vector<std::string> paths;
+  int threads = std::max(1u, std::thread::hardware_concurrency());
+  engine::precision precision = engine::precision::float64;
+  bool valid = true;
+  for (size_t i = 0; i < args.size(); i++) {
+    std::optional<int> count;
+    std::optional<double> rate;
+    if (args[i] == "--threads" && i + 1 < args.size() && (count = arguments::integer(args[i + 1], 1, 1024))) {
+      threads = count.value();
+      i++;
+    } else if (args[i] == "--rate" && i + 1 < args.size() && (rate = arguments::positive(args[i + 1]))) {
+      engine::sampleRate = rate.value();
+      i++;
+    } else if (args[i] == "--float32") {
+      precision = engine::precision::float32;
+    } else if (args[i][0] != '-') {
+      paths.push_back(args[i]);
+    } else {
+      valid = false;
+    }
+  }
+  if (!valid || paths.size() != 2 || !std::filesystem::is_directory(paths[0])) {
+    std::cerr << "usage: AnaSynthRender <score directory> <output directory> [--threads n] [--rate hz] [--float32]\n";
+    return 2;
+  }
+  std::filesystem::path outputDirectory = paths[1];
+  std::filesystem::create_directories(outputDirectory);
+
+  // everything is parsed up front, so the longest files can be handed out first and nobody is left waiting on one at the end
+  std::vector<batch::score> scores;
+  int failed = 0;
+  for (const auto& entry : std::filesystem::directory_iterator(paths[0])) {
+    if (!entry.is_regular_file() || entry.path().extension() != ".score") {
+      continue;
+    }
+    std::string error;
+    std::optional<batch::score> s = batch::parse_score(entry.path(), error);
+    if (s) {
+      scores.push_back(std::move(s.value()));
+    } else {
+      std::cerr << "Error: " << entry.path().string() << ": " << error << "\n";
+      failed++;
+    }
+  }
+  std::sort(scores.begin(), scores.end(), [](const batch::score& a, const batch::score& b) { return a.length > b.length; });
+
+  auto started = std::chrono::steady_clock::now();
+  batch::lastFinished = started;
+  auto elapsed = [&started](std::chrono::steady_clock::time_point until) {
+    return std::chrono::duration<double>(until - started).count();
+  };
+  std::atomic<size_t> next = 0;
+  std::vector<std::thread> pool;
+  threads = std::min<int>(threads, std::max<size_t>(1, scores.size()));
+  for (int t = 0; t < threads; t++) {
+    pool.emplace_back([&]() {
+      for (size_t i = next++; i < scores.size(); i = next++) {
+        std::filesystem::path output = outputDirectory / scores[i].path.filename().replace_extension(".wav");
+        batch::render(scores[i], precision, output);
+      }
+    });
+  }
+  {
+    // progress twice a second, and right away whenever a file finishes
+    std::unique_lock<std::mutex> lock(batch::progress);
+    while (batch::filesDone < scores.size()) {
+      batch::fileFinished.wait_for(lock, std::chrono::milliseconds(500));
+      double audioSeconds = batch::samplesRendered / engine::sampleRate;
+      std::cerr << "\r" << batch::filesDone << "/" << scores.size() << " files, " << std::fixed << std::setprecision(1)
+                << audioSeconds << " s of audio, " << audioSeconds / elapsed(std::chrono::steady_clock::now()) << " s/s   "
+                << std::flush;
+    }
+  }
+  for (std::thread& t : pool) {
+    t.join();
+  }
+  double audioSeconds = batch::samplesRendered / engine::sampleRate;
+  double seconds = elapsed(batch::lastFinished);
+  std::cerr << "\rrendered " << scores.size() << " files on " << threads << " threads: " << std::fixed << std::setprecision(1)
+            << audioSeconds << " s of audio in " << seconds << " s, " << audioSeconds / std::max(seconds, 1e-9)
+            << " s of audio per second\n";
+  if (failed > 0) {
+    std::cerr << failed << " files could not be read\n";
+  }
+  if (batch::filesUnwritten > 0) {
+    std::cerr << batch::filesUnwritten << " files could not be written\n";
+  }
+  return failed > 0 || batch::filesUnwritten > 0 ? 1 : 0;
+}
@@ -0,0 +1,58 @@
+// the fast math against libm, natively: first fastmath::report(), then the voice kernel that uses it, circuit::rlc_currents,
+// against the same loop written with libm and a branch per regime. the kernel evaluates every regime for every voice so
+// it stays branch-free, so the difference depends on how well it vectorizes, and CMake builds this for the machine it
+// runs on. run with a release build, the default:
+//
+//   fastmath_bench [voices]
+
+#include "AnaSynthEngine.h"
+
+#include <iostream>
+#include <string>
+
+int main(int argc, char** argv)
+{
+  std::cout << fastmath::report();
+
+  const int voices = argc > 1 ? std::max(1, std::stoi(argv[1])) : 4096;
+  const int repeats = (1 << 24) / voices + 1;
+  std::mt19937_64 generator(1);
+  std::uniform_real_distribution<double> frequency(20, 20000), timeConstant(0.05, 5), time(0, 5);
+  std::vector<circuit::rlc_response> circuits(voices);
+  std::vector<double> times(voices), fast(voices), reference(voices);
+  for (int k = 0; k < voices; k++) {
+    circuits[k] = circuit::solve_rlc(frequency(generator), 1.0 / voices, timeConstant(generator));
+    times[k] = time(generator);
+  }
+  auto timed = [&](auto kernel) {
+    auto started = std::chrono::steady_clock::now();
+    for (int r = 0; r < repeats; r++) {
+      kernel();
+    }
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - started).count() / (double(repeats) * voices);
+  };
+  double fastNanoseconds = timed([&] { circuit::rlc_currents(circuits, times, fast); });
+  double referenceNanoseconds = timed([&] {
+    for (int k = 0; k < voices; k++) {
+      const circuit::rlc_response& c = circuits[k];
+      double t = times[k];
+      if (c.regime == circuit::damping::underdamped) {
+        reference[k] = c.amplitude * std::exp(-c.alpha * t) * std::sin(c.omega * t);
+      } else if (c.regime == circuit::damping::overdamped) {
+        reference[k] = c.amplitude * (std::exp((c.omega - c.alpha) * t) - std::exp(-(c.omega + c.alpha) * t)) / 2;
+      } else {
+        reference[k] = c.amplitude * std::exp(-c.alpha * t) * t;
+      }
+    }
+  });
+  double worst = 0, fastSum = 0, referenceSum = 0;
+  for (int k = 0; k < voices; k++) {
+    worst = std::max(worst, std::abs(fast[k] - reference[k]) / circuits[k].amplitude);
+    fastSum += fast[k];
+    referenceSum += reference[k];
+  }
+  std::cout << std::setprecision(3) << "rlc_currents over " << voices << " voices: max error " << worst
+            << " of the initial volume, sum " << fastSum << " against " << referenceSum << ", " << fastNanoseconds
+            << " ns per voice against " << referenceNanoseconds << " ns with libm\n";
+  return 0;
+}
@@ -1 +1 @@
-em++ AnaSynth.cpp -o AnaSynth.js -sNO_EXIT_RUNTIME=1 -sUSE_BOOST_HEADERS=1 -std=c++20 -lembind -g -sNO_DISABLE_EXCEPTION_CATCHING  
\ No newline at end of file
+em++ AnaSynth.cpp -o AnaSynth.js -sNO_EXIT_RUNTIME=1 -sUSE_BOOST_HEADERS=1 -std=c++20 -lembind -pthread -sPTHREAD_POOL_SIZE=navigator.hardwareConcurrency -g -O3 -msimd128 -sNO_DISABLE_EXCEPTION_CATCHING  
\ No newline at end of file
@@ -1 +1 @@
-python3 -m http.server
\ No newline at end of file
+python3 -c "import http.server as h; h.test(type('H', (h.SimpleHTTPRequestHandler,), {'end_headers': lambda s: (s.send_header('Cross-Origin-Opener-Policy', 'same-origin'), s.send_header('Cross-Origin-Embedder-Policy', 'require-corp'), h.SimpleHTTPRequestHandler.end_headers(s))}), port=8000)"
\ No newline at end of file
@@ -0,0 +1,114 @@
+// checks circuit::solve_rlc and circuit::rlc_currents in every damping regime against a long double RK4 integration of
+// L di/dt + Ri + q/C = 0, the same initial conditions the page uses: the capacitor charged to the battery, no current.
+// exits non-zero on the first mismatch. run through ctest, or on its own: circuit_test
+
+#include "AnaSynthEngine.h"
+
+#include <iostream>
+
+namespace
+{
+  int failures = 0;
+
+  std::string scientific(double x)
+  {
+    std::ostringstream out;
+    out << std::scientific << std::setprecision(2) << x;
+    return out.str();
+  }
+
+  void check(bool ok, const std::string& what)
+  {
+    std::cout << (ok ? "ok      " : "FAILED  ") << what << std::endl;
+    failures += !ok;
+  }
+
+  // the current every `spacing` seconds up to `length`, integrated with `steps` RK4 steps per sample
+  std::vector<long double> reference(long double l, long double c, long double r, long double v, double spacing,
+                                     double length, int steps)
+  {
+    long double q = -c * v, i = 0;
+    long double h = spacing / (long double)steps;
+    auto di = [&](long double q, long double i) { return (-r * i - q / c) / l; };
+    std::vector<long double> out;
+    for (double t = 0; t <= length; t += spacing)
+    {
+      out.emplace_back(i);
+      for (int n = 0; n < steps; n++)
+      {
+        long double k1q = i, k1i = di(q, i);
+        long double k2q = i + h / 2 * k1i, k2i = di(q + h / 2 * k1q, i + h / 2 * k1i);
+        long double k3q = i + h / 2 * k2i, k3i = di(q + h / 2 * k2q, i + h / 2 * k2i);
+        long double k4q = i + h * k3i, k4i = di(q + h * k3q, i + h * k3i);
+        q += h / 6 * (k1q + 2 * k2q + 2 * k3q + k4q);
+        i += h / 6 * (k1i + 2 * k2i + 2 * k3i + k4i);
+      }
+    }
+    return out;
+  }
+
+  // largest difference between the closed form and the integration, relative to the peak current
+  double worst_error(double l, double c, double r, double v, circuit::damping regime, double spacing, double length,
+                     int steps)
+  {
+    circuit::rlc_response response = circuit::solve_rlc(l, c, r, v);
+    check(response.regime == regime, "regime for L = " + std::to_string(l) + " C = " + std::to_string(c) + " R = " +
+          std::to_string(r));
+    std::vector<long double> expected = reference(l, c, r, v, spacing, length, steps);
+    std::vector<circuit::rlc_response> circuits(expected.size(), response);
+    std::vector<double> times(expected.size()), currents(expected.size());
+    for (size_t k = 0; k < times.size(); k++)
+    {
+      times[k] = k * spacing;
+    }
+    circuit::rlc_currents(circuits, times, currents);
+    long double peak = 0, worst = 0;
+    for (size_t k = 0; k < expected.size(); k++)
+    {
+      peak = std::max(peak, std::abs(expected[k]));
+      worst = std::max(worst, std::abs(currents[k] - expected[k]));
+    }
+    return double(worst / peak);
+  }
+}
+
+int main()
+{
+  // 0.1 H and 1 µF ring at about 503 Hz
+  const double l = 0.1, c = 1e-6;
+  const double critical = 2 * sqrt(l / c);
+  double error = worst_error(l, c, 4, 9, circuit::damping::underdamped, 1e-4, 0.25, 100);
+  check(error < 1e-9, "underdamped matches, relative error " + scientific(error));
+  error = worst_error(l, c, critical * (1 - 1e-6), 9, circuit::damping::underdamped, 1e-5, 0.02, 100);
+  check(error < 1e-9, "just below critical matches, relative error " + scientific(error));
+  error = worst_error(l, c, critical, 9, circuit::damping::critically_damped, 1e-5, 0.02, 100);
+  check(error < 1e-9, "critically damped matches, relative error " + scientific(error));
+  error = worst_error(l, c, critical * 1.5, 9, circuit::damping::overdamped, 1e-5, 0.02, 100);
+  check(error < 1e-9, "overdamped matches, relative error " + scientific(error));
+  // the fast mode decays in about 10 ns here, so the integration needs small steps
+  error = worst_error(l, c, 10000, 9, circuit::damping::overdamped, 1e-5, 0.05, 1000);
+  check(error < 1e-9, "heavily overdamped matches, relative error " + scientific(error));
+
+  // e^-αt and e^ωt on their own would both overflow at this resistance and time
+  circuit::rlc_response huge = circuit::solve_rlc(l, c, 1e9, 9);
+  std::vector<circuit::rlc_response> circuits = {huge};
+  std::vector<double> times = {1e-3}, currents(1);
+  circuit::rlc_currents(circuits, times, currents);
+  check(std::isfinite(currents[0]) && currents[0] > 0, "huge resistance stays finite");
+
+  check(circuit::damped_frequency(l, c, critical * 1.5) == 0, "overdamped circuits have no frequency");
+  double undamped = 1 / (2 * std::numbers::pi * sqrt(l * c));
+  double damped = sqrt(1 / (l * c) - 20 * 20) / (2 * std::numbers::pi);
+  check(std::abs(circuit::damped_frequency(l, c, 4) - damped) < 1e-9 * damped && damped < undamped,
+        "damped frequency is below the undamped one");
+
+  // the triples voices are stored as
+  circuits = {circuit::solve_rlc(440, 0.5, 0.3)};
+  times = {0.0123};
+  circuit::rlc_currents(circuits, times, currents);
+  double expected = 0.5 * exp(-0.0123 / 0.3) * sin(2 * std::numbers::pi * 440 * 0.0123);
+  check(std::abs(currents[0] - expected) < 1e-10, "voice triples ring at their frequency and time constant");
+
+  std::cout << (failures ? std::to_string(failures) + " failed" : "all passed") << std::endl;
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,61 @@
+// checks resynthesis::analyze on a recording it should take apart exactly: a few damped sinusoids added together, the
+// same kind of sound every voice makes. each one has to come back as a circuit with its frequency and time constant.
+// exits non-zero on the first mismatch. run through ctest, or on its own: resynthesis_test
+
+#include "AnaSynthEngine.h"
+
+#include <iostream>
+
+namespace
+{
+  int failures = 0;
+
+  void check(bool ok, const std::string& what)
+  {
+    std::cout << (ok ? "ok      " : "FAILED  ") << what << std::endl;
+    failures += !ok;
+  }
+
+  struct partial
+  {
+    double frequency, amplitude, timeConstant;
+  };
+
+  void recovers(const std::vector<partial>& partials, double sampleRate, double seconds)
+  {
+    std::vector<double> samples(llround(seconds * sampleRate));
+    for (const partial& p : partials) {
+      for (size_t i = 0; i < samples.size(); i++) {
+        double t = i / sampleRate;
+        samples[i] += p.amplitude * exp(-t / p.timeConstant) * sin(2*std::numbers::pi * p.frequency * t);
+      }
+    }
+    resynthesis::result r = resynthesis::analyze(samples, sampleRate);
+    check(r.rlcs.size() >= partials.size(), std::to_string(r.rlcs.size()) + " circuits for " +
+          std::to_string(partials.size()) + " partials at " + std::to_string(int(sampleRate)) + " Hz");
+    for (const partial& p : partials) {
+      // the circuit closest in frequency is the one that should match
+      auto found = std::min_element(r.rlcs.begin(), r.rlcs.end(), [&p](auto& x, auto& y) {
+        return std::abs(std::get<0>(x) - p.frequency) < std::abs(std::get<0>(y) - p.frequency);
+      });
+      if (found == r.rlcs.end()) {
+        check(false, "nothing found near " + std::to_string(p.frequency) + " Hz");
+        continue;
+      }
+      auto [frequency, amplitude, timeConstant] = *found;
+      std::ostringstream what;
+      what << std::fixed << std::setprecision(3) << p.frequency << " Hz, τ = " << p.timeConstant << " s came back as "
+           << frequency << " Hz, τ = " << timeConstant << " s";
+      check(std::abs(frequency / p.frequency - 1) < 0.003 && std::abs(timeConstant / p.timeConstant - 1) < 0.05, what.str());
+    }
+  }
+}
+
+int main()
+{
+  // apart by more than maxDrift, so they are tracked as separate partials
+  recovers({{220, 0.5, 0.8}, {554.37, 0.3, 0.4}, {1318.5, 0.2, 1.5}}, 48000, 3);
+  recovers({{110, 0.4, 2}, {440, 0.25, 0.25}, {3520, 0.1, 0.6}}, 44100, 4);
+  std::cout << (failures ? std::to_string(failures) + " failed" : "all passed") << std::endl;
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,247 @@
+// the lock-free queues between the ui and the renderer under two real threads, meant to be built with ThreadSanitizer
+// (CMake adds -fsanitize=thread when the compiler has it). first the ring on its own, single and batched, then the
+// command and telemetry protocol the page uses, with the ui falling behind on purpose so the reports fill up, and last
+// that the renderer never allocates, whatever it is sent. exits non-zero on the first mismatch, and ThreadSanitizer fails it on any race. run through ctest, or: ring_stress_test
+
+#include "AnaSynthEngine.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <thread>
+
+namespace
+{
+  int failures = 0;
+  // every allocation made while a thread has rendering set is counted
+  thread_local bool rendering = false;
+  std::atomic<long> renderAllocations = 0;
+
+  void* allocate(size_t size, size_t alignment)
+  {
+    if (rendering) {
+      renderAllocations++;
+    }
+    size = std::max<size_t>(size, 1);
+    void* p = alignment > alignof(std::max_align_t) ? std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment)
+                                                    : std::malloc(size);
+    if (!p) {
+      throw std::bad_alloc();
+    }
+    return p;
+  }
+}
+
+// the array and nothrow forms all end up in these
+void* operator new(size_t size) { return allocate(size, 0); }
+void* operator new(size_t size, std::align_val_t alignment) { return allocate(size, size_t(alignment)); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+
+namespace
+{
+  void check(bool ok, const std::string& what)
+  {
+    std::cout << (ok ? "ok      " : "FAILED  ") << what << std::endl;
+    failures += !ok;
+  }
+
+  void ring_order()
+  {
+    // every value arrives exactly once and in order, whichever mix of single and batched calls moved it
+    const uint64_t count = 200000;
+    engine::spsc_ring<uint64_t, 64> ring;
+    std::thread producer([&ring] {
+      std::array<uint64_t, 7> batch;
+      uint64_t next = 0;
+      while (next < count) {
+        if (next % 3 == 0) {
+          if (!engine::push(ring, next)) {
+            std::this_thread::yield();
+            continue;
+          }
+          next++;
+        } else {
+          size_t n = std::min<uint64_t>(batch.size(), count - next);
+          for (size_t i = 0; i < n; i++) {
+            batch[i] = next + i;
+          }
+          size_t pushed = engine::push_many(ring, std::span<const uint64_t>(batch.data(), n));
+          next += pushed;
+          if (pushed == 0) {
+            std::this_thread::yield();
+          }
+        }
+      }
+    });
+    std::array<uint64_t, 5> batch;
+    uint64_t expected = 0;
+    bool ordered = true;
+    while (expected < count) {
+      uint64_t value;
+      size_t popped = 0;
+      if (expected % 2 == 0) {
+        if (engine::pop(ring, value)) {
+          ordered &= value == expected++;
+          popped = 1;
+        }
+      } else {
+        popped = engine::pop_many(ring, std::span<uint64_t>(batch));
+        for (size_t i = 0; i < popped; i++) {
+          ordered &= batch[i] == expected++;
+        }
+      }
+      if (popped == 0) {
+        std::this_thread::yield();
+      }
+    }
+    producer.join();
+    check(ordered, "ring keeps the order of " + std::to_string(count) + " values");
+    uint64_t value;
+    check(!engine::pop(ring, value), "ring is empty afterwards");
+  }
+
+  void hand_backs()
+  {
+    // the page's protocol: filter cascades handed to the renderer and handed back for this thread to free. the renderer
+    // never frees one itself, so every cascade sent but the one in use comes back, however far behind this side is
+    std::atomic<bool> stop = false;
+    std::thread renderer([&stop] {
+      std::vector<double> block(256);
+      while (!stop) {
+        std::fill(block.begin(), block.end(), 0);
+        engine::process(block);
+        std::this_thread::yield();
+      }
+    });
+    std::vector<engine::biquad_section>* last = nullptr;
+    int sent = 0, refused = 0, returned = 0, blocks = 0;
+    long long lastSample = 0;
+    bool monotonic = true;
+    auto drain = [&] {
+      engine::telemetry t;
+      while (engine::pop(engine::reports, t)) {
+        if (t.type == engine::telemetry::kind::free_sections) {
+          returned++;
+          delete t.sections;
+        } else if (t.type == engine::telemetry::kind::block) {
+          monotonic &= t.sample >= lastSample;
+          lastSample = t.sample;
+          blocks++;
+        }
+      }
+    };
+    for (int round = 0; round < 200; round++) {
+      // every few rounds the ui stalls and sends without reading anything back, long enough to fill the reports and
+      // with them the commands, which the renderer then stops taking
+      bool stalled = round % 4 == 3;
+      for (int i = 0; i < (stalled ? 1500 : 20); i++) {
+        auto sections = std::make_unique<std::vector<engine::biquad_section>>(1, engine::biquad_section{1, 0, 0, 0, 0});
+        engine::command c{.type = engine::command::kind::set_speaker, .sections = sections.get()};
+        if (engine::push(engine::commands, c)) {
+          last = sections.release();
+          sent++;
+        } else {
+          refused++;
+        }
+        engine::push(engine::commands, {.type = engine::command::kind::hold_keys, .held = uint32_t(i)});
+        if (!stalled) {
+          drain();
+          std::this_thread::yield();
+        }
+      }
+    }
+    // let the renderer take everything still queued, then stop it and collect the rest
+    while (engine::free_slots(engine::commands) < engine::commands.slots.size()) {
+      drain();
+      std::this_thread::yield();
+    }
+    stop = true;
+    renderer.join();
+    drain();
+    check(sent > 0 && refused > 0 && blocks > 0, "sent " + std::to_string(sent) + " cascades, " + std::to_string(refused) +
+          " refused while the queue was full, " + std::to_string(blocks) + " block reports");
+    check(returned == sent - 1, "all but the cascade in use came back, " + std::to_string(returned) + " of " +
+          std::to_string(sent - 1));
+    check(engine::live.speakerSections.get() == last, "the renderer uses the last cascade sent");
+    check(monotonic, "block reports never go back in time");
+  }
+
+  void render_allocations()
+  {
+    // everything that can be sent while the renderer runs: buffers, a room, a keyboard the sequencer plays from and
+    // more voices than there is room for. the renderer only swaps pointers, so none of it may allocate over there
+    auto send = [](const engine::command& c) {
+      while (!engine::push(engine::commands, c)) {
+        engine::poll_telemetry();
+        std::this_thread::yield();
+      }
+    };
+    auto keys = std::make_unique<engine::keyboard>(13);
+    for (int key = 0; key < 13; key++) {
+      for (int harmonic = 1; harmonic <= 10; harmonic++) {
+        if (auto v = engine::make_voice(harmonic, 220 * pow(2, key / 12.0) * harmonic, 0.5 / harmonic, 1, 0)) {
+          (*keys)[key].push_back(*v);
+        }
+      }
+    }
+    std::atomic<bool> stop = false;
+    std::thread renderer([&stop] {
+      std::vector<double> block(256);
+      rendering = true;
+      while (!stop) {
+        std::fill(block.begin(), block.end(), 0);
+        engine::process(block);
+        std::this_thread::yield();
+      }
+      rendering = false;
+    });
+    send({.type = engine::command::kind::set_buffers, .buffers = engine::make_buffers(256).release()});
+    send({.type = engine::command::kind::set_keyboard, .keys = keys.release()});
+    engine::pattern fast;
+    fast.tempo = 600;
+    fast.partials = 10;
+    send({.type = engine::command::kind::set_pattern, .sequence = fast});
+    send({.type = engine::command::kind::transport, .run = true});
+    for (int round = 0; round < 40; round++) {
+      auto room = engine::make_convolver(engine::synthetic_room(0.1 + 0.01 * round, engine::sampleRate), engine::partitionSize);
+      send({.type = engine::command::kind::set_room, .room = new engine::partitioned_convolver(std::move(room))});
+      send({.type = engine::command::kind::set_room_wet, .wet = 0.3});
+      send({.type = engine::command::kind::set_precision,
+            .renderPrecision = round % 2 ? engine::precision::float32 : engine::precision::float64});
+      send({.type = engine::command::kind::hold_keys, .held = uint32_t(round)});
+      for (size_t id = 0; id < 100; id++) {
+        if (auto v = engine::make_voice(round * 100 + id, 100 + id, 0.01, 10, engine::reported.sample)) {
+          send({.type = engine::command::kind::start_voice, .started = *v});
+        }
+        if (id % 10 == 0) {
+          send({.type = engine::command::kind::stop_voice, .id = round * 100 + id - 50, .sample = engine::reported.sample});
+        }
+      }
+      if (round % 10 == 9) {
+        send({.type = engine::command::kind::set_buffers, .buffers = engine::make_buffers(256).release()});
+      }
+      engine::poll_telemetry();
+      std::this_thread::yield();
+    }
+    while (engine::free_slots(engine::commands) < engine::commands.slots.size()) {
+      engine::poll_telemetry();
+      std::this_thread::yield();
+    }
+    stop = true;
+    renderer.join();
+    engine::poll_telemetry();
+    check(engine::live.voices.size() <= engine::maxVoices, std::to_string(engine::live.voices.size()) +
+          " voices sounding, at most " + std::to_string(engine::maxVoices));
+    check(renderAllocations == 0, "the renderer allocated " + std::to_string(renderAllocations) + " times");
+  }
+}
+
+int main()
+{
+  ring_order();
+  hand_backs();
+  render_allocations();
+  std::cout << (failures ? std::to_string(failures) + " failed" : "all passed") << std::endl;
+  return failures ? 1 : 0;
+}